@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * One formatting job measured by the benchmark: impl renders row i of scenario and returns the output size
+ */
+struct Case
+{
+    std::string scenario;
+    std::string impl;
+    std::function<size_t(int)> run;
+};
+
+/**
+ * The scenarios, each group formats the same text so that their numbers can be compared
+ */
+std::vector<Case> Cpp11Cases();
+std::vector<Case> Cpp17Cases();
+std::vector<Case> BaselineCases();
+
+/**
+ * Template with a long literal and only a few {}, shared by all implementations
+ */
+const std::string& LongTemplate();
+
+/**
+ * Every case of the three groups, sorted by scenario
+ */
+std::vector<Case> AllCases();
+
+struct Result
+{
+    // wall time per op of one thread, equal to the single thread number when scaling is linear
+    double ns_per_op = 0;
+    // ops of all threads per second
+    double ops_per_second = 0;
+    double allocations_per_op = 0;
+    double bytes_per_op = 0;
+};
+
+/**
+ * Run c.run iterations times on each of threads threads after a warm up, the threads start together.
+ * Allocations are counted by the operator new of bench/harness.cpp
+ */
+Result Measure(const Case& c, int iterations, int threads);
@@ -0,0 +1,120 @@
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include "bench.h"
+
+namespace
+{
+struct Track
+{
+    float x = 10;
+    float y = 1;
+    std::string motion_type = "Moving";
+};
+
+size_t Snprintf(const char* format, ...)
+{
+    char buffer[4096];
+    va_list args;
+    va_start(args, format);
+    int size = std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return std::string(buffer, size).size();
+}
+}
+
+const std::string& LongTemplate()
+{
+    static const std::string long_template = [] {
+        std::string text;
+        while (text.size() < 2048)
+        {
+            text += "The quick brown fox jumps over the lazy dog, ";
+        }
+        return text + "row {} of {} has value {:.2f}";
+    }();
+    return long_template;
+}
+
+std::vector<Case> BaselineCases()
+{
+    static std::string name = "sensor-7";
+    static std::string city = "Shanghai";
+    static Track track;
+    static std::string long_prefix = LongTemplate().substr(0, LongTemplate().find('{'));
+    const std::string snprintf_impl = "snprintf";
+    const std::string to_string_impl = "to_string";
+    const std::string stream_impl = "ostringstream";
+    return {
+            {"int", snprintf_impl, [](int i) {
+                return Snprintf("id=%d count=%d total=%lld", i, i * 3, static_cast<long long>(i) * 1000003);
+            }},
+            {"float", snprintf_impl, [](int i) {
+                return Snprintf("x=%.3f y=%.3f v=%g", i * 0.5f, i * 0.25, i * 1.5);
+            }},
+            {"string", snprintf_impl, [](int i) {
+                return Snprintf("name=%s city=%s tag=%s", name.c_str(), city.c_str(), name.c_str());
+            }},
+            {"custom", snprintf_impl, [](int i) {
+                return Snprintf("track %d x=%f,y=%f,motion=%s", i, track.x, track.y, track.motion_type.c_str());
+            }},
+            {"args1", snprintf_impl, [](int i) { return Snprintf("%d", i); }},
+            {"args8", snprintf_impl, [](int i) { return Snprintf("%d %d %d %d %d %d %d %d", i, i, i, i, i, i, i, i); }},
+            {"long", snprintf_impl, [](int i) {
+                return Snprintf("%srow %d of %s has value %.2f", long_prefix.c_str(), i, name.c_str(), i * 0.5);
+            }},
+            {"int", to_string_impl, [](int i) {
+                return ("id=" + std::to_string(i) + " count=" + std::to_string(i * 3) +
+                        " total=" + std::to_string(int64_t(i) * 1000003)).size();
+            }},
+            {"string", to_string_impl, [](int i) {
+                return ("name=" + name + " city=" + city + " tag=" + name).size();
+            }},
+            {"args1", to_string_impl, [](int i) { return std::to_string(i).size(); }},
+            {"args8", to_string_impl, [](int i) {
+                auto s = std::to_string(i);
+                return (s + " " + s + " " + s + " " + s + " " + s + " " + s + " " + s + " " + s).size();
+            }},
+            {"int", stream_impl, [](int i) {
+                std::ostringstream stream;
+                stream << "id=" << i << " count=" << i * 3 << " total=" << int64_t(i) * 1000003;
+                return stream.str().size();
+            }},
+            {"float", stream_impl, [](int i) {
+                std::ostringstream stream;
+                stream.setf(std::ios::fixed);
+                stream.precision(3);
+                stream << "x=" << i * 0.5f << " y=" << i * 0.25;
+                stream.unsetf(std::ios::fixed);
+                stream.precision(6);
+                stream << " v=" << i * 1.5;
+                return stream.str().size();
+            }},
+            {"string", stream_impl, [](int i) {
+                std::ostringstream stream;
+                stream << "name=" << name << " city=" << city << " tag=" << name;
+                return stream.str().size();
+            }},
+            {"custom", stream_impl, [](int i) {
+                std::ostringstream stream;
+                stream.setf(std::ios::fixed);
+                stream << "track " << i << " x=" << track.x << ",y=" << track.y << ",motion=" << track.motion_type;
+                return stream.str().size();
+            }},
+            {"args8", stream_impl, [](int i) {
+                std::ostringstream stream;
+                stream << i << ' ' << i << ' ' << i << ' ' << i << ' ' << i << ' ' << i << ' ' << i << ' ' << i;
+                return stream.str().size();
+            }},
+            {"long", stream_impl, [](int i) {
+                std::ostringstream stream;
+                stream.setf(std::ios::fixed);
+                stream.precision(2);
+                stream << long_prefix << "row " << i << " of " << name << " has value " << i * 0.5;
+                return stream.str().size();
+            }},
+    };
+}
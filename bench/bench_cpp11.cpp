@@ -0,0 +1,50 @@
+// my_format_cpp11.h defines the same names as my_format_cpp17.h, so it is wrapped in a namespace here
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cpp11
+{
+#include "../my_format_cpp11.h"
+}
+
+#include "bench.h"
+
+namespace
+{
+class Track
+{
+public:
+    std::string ToString()
+    {
+        return "x=" + std::to_string(x) + ",y=" + std::to_string(y) + ",motion=" + motion_type;
+    }
+
+    float x = 10;
+    float y = 1;
+    std::string motion_type = "Moving";
+};
+}
+
+std::vector<Case> Cpp11Cases()
+{
+    static std::string name = "sensor-7";
+    static std::string city = "Shanghai";
+    static Track track;
+    const std::string impl = "cpp11 Format";
+    return {
+            {"int", impl, [](int i) { return cpp11::Format("id={} count={} total={}", i, i * 3, int64_t(i) * 1000003).size(); }},
+            {"float", impl, [](int i) { return cpp11::Format("x={:.3f} y={:.3f} v={}", i * 0.5f, i * 0.25, i * 1.5).size(); }},
+            {"string", impl, [](int i) { return cpp11::Format("name={} city={} tag={}", name, city, name).size(); }},
+            {"custom", impl, [](int i) { return cpp11::Format("track {} {}", i, track).size(); }},
+            {"args1", impl, [](int i) { return cpp11::Format("{}", i).size(); }},
+            {"args8", impl, [](int i) { return cpp11::Format("{} {} {} {} {} {} {} {}", i, i, i, i, i, i, i, i).size(); }},
+            {"long", impl, [](int i) { return cpp11::Format(LongTemplate(), i, name, i * 0.5).size(); }},
+    };
+}
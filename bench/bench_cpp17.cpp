@@ -0,0 +1,66 @@
+#include "../my_format_cpp17.h"
+
+#include "bench.h"
+
+namespace
+{
+class Track
+{
+public:
+    string ToString()
+    {
+        return "x=" + std::to_string(x) + ",y=" + std::to_string(y) + ",motion=" + motion_type;
+    }
+
+    float x = 10;
+    float y = 1;
+    string motion_type = "Moving";
+};
+
+class FastTrack : public Track
+{
+public:
+    void FormatTo(Writer& writer, const Parser::FormatInfo& format_info) const
+    {
+        ::FormatTo(writer, FORMAT_STRING("x={:.6f},y={:.6f},motion={}"), x, y, motion_type);
+    }
+};
+}
+
+std::vector<Case> Cpp17Cases()
+{
+    static string name = "sensor-7";
+    static string city = "Shanghai";
+    static Track track;
+    static FastTrack fast_track;
+    const string impl = "cpp17 Format";
+    const string compiled_impl = "cpp17 FORMAT_STRING";
+    return {
+            {"int", impl, [](int i) { return Format("id={} count={} total={}", i, i * 3, int64_t(i) * 1000003).size(); }},
+            {"float", impl, [](int i) { return Format("x={:.3f} y={:.3f} v={}", i * 0.5f, i * 0.25, i * 1.5).size(); }},
+            {"string", impl, [](int i) { return Format("name={} city={} tag={}", name, city, name).size(); }},
+            {"custom", impl, [](int i) { return Format("track {} {}", i, track).size(); }},
+            {"args1", impl, [](int i) { return Format("{}", i).size(); }},
+            {"args8", impl, [](int i) { return Format("{} {} {} {} {} {} {} {}", i, i, i, i, i, i, i, i).size(); }},
+            {"long", impl, [](int i) { return Format(LongTemplate(), i, name, i * 0.5).size(); }},
+            {"int", compiled_impl, [](int i) {
+                return Format(FORMAT_STRING("id={} count={} total={}"), i, i * 3, int64_t(i) * 1000003).size();
+            }},
+            {"float", compiled_impl, [](int i) {
+                return Format(FORMAT_STRING("x={:.3f} y={:.3f} v={}"), i * 0.5f, i * 0.25, i * 1.5).size();
+            }},
+            {"string", compiled_impl, [](int i) {
+                return Format(FORMAT_STRING("name={} city={} tag={}"), name, city, name).size();
+            }},
+            {"custom", compiled_impl, [](int i) { return Format(FORMAT_STRING("track {} {}"), i, fast_track).size(); }},
+            {"int", "cpp17 FormatCached", [](int i) {
+                return FormatCached("id={} count={} total={}", i, i * 3, int64_t(i) * 1000003).size();
+            }},
+            {"int", "cpp17 FormatInto", [](int i) {
+                thread_local string out;
+                out.clear();
+                FormatInto(out, FORMAT_STRING("id={} count={} total={}"), i, i * 3, int64_t(i) * 1000003);
+                return out.size();
+            }},
+    };
+}
@@ -0,0 +1,55 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+
+/**
+ * Benchmark of Format from my_format_cpp11.h and my_format_cpp17.h against snprintf,
+ * std::to_string concatenation and std::ostringstream.
+ * Usage: my_format_bench [--iterations N] [--filter scenario]
+ * Thread scaling is measured by my_format_scaling, see bench/scaling_main.cpp
+ */
+
+namespace
+{
+void PrintHeader(const char* first_column)
+{
+    std::printf("%-10s %-22s %12s %12s %12s\n", first_column, "impl", "ns/op", "allocs/op", "bytes/op");
+}
+
+void PrintRow(const std::string& first_column, const std::string& impl, const Result& result)
+{
+    std::printf("%-10s %-22s %12.1f %12.2f %12.1f\n", first_column.c_str(), impl.c_str(), result.ns_per_op,
+                result.allocations_per_op, result.bytes_per_op);
+}
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 200000;
+    std::string filter;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (std::strcmp(argv[i], "--iterations") == 0)
+        {
+            iterations = std::atoi(argv[i + 1]);
+        }
+        else if (std::strcmp(argv[i], "--filter") == 0)
+        {
+            filter = argv[i + 1];
+        }
+    }
+
+    std::vector<Case> cases = AllCases();
+
+    PrintHeader("scenario");
+    for (auto& c : cases)
+    {
+        if (filter.empty() or c.scenario == filter)
+        {
+            PrintRow(c.scenario, c.impl, Measure(c, iterations, 1));
+        }
+    }
+    return 0;
+}
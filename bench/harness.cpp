@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+#include "bench.h"
+
+namespace
+{
+// every allocation of the calling thread is counted by the operator new below
+thread_local size_t t_allocations = 0;
+thread_local size_t t_allocated_bytes = 0;
+}
+
+void* operator new(size_t size)
+{
+    t_allocations++;
+    t_allocated_bytes += size;
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+std::vector<Case> AllCases()
+{
+    std::vector<Case> cases;
+    for (auto& group : {Cpp11Cases(), Cpp17Cases(), BaselineCases()})
+    {
+        cases.insert(cases.end(), group.begin(), group.end());
+    }
+    std::stable_sort(cases.begin(), cases.end(), [](const Case& a, const Case& b) { return a.scenario < b.scenario; });
+    return cases;
+}
+
+Result Measure(const Case& c, int iterations, int threads)
+{
+    std::atomic<size_t> allocations{0};
+    std::atomic<size_t> allocated_bytes{0};
+    std::atomic<size_t> sink{0};
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+
+    auto worker = [&] {
+        // warm up caches and lazily built tables before counting
+        size_t output = 0;
+        for (int i = 0; i < std::min(iterations, 1000); i++)
+        {
+            output += c.run(i);
+        }
+        ready++;
+        while (not go.load())
+        {
+            std::this_thread::yield();
+        }
+        size_t allocations_before = t_allocations;
+        size_t bytes_before = t_allocated_bytes;
+        for (int i = 0; i < iterations; i++)
+        {
+            output += c.run(i);
+        }
+        allocations += t_allocations - allocations_before;
+        allocated_bytes += t_allocated_bytes - bytes_before;
+        sink += output;
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++)
+    {
+        pool.emplace_back(worker);
+    }
+    while (ready.load() < threads)
+    {
+        std::this_thread::yield();
+    }
+    auto begin = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& thread : pool)
+    {
+        thread.join();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+
+    double ops = static_cast<double>(iterations) * threads;
+    Result result;
+    result.ns_per_op = ns / iterations;
+    result.ops_per_second = ops / ns * 1e9;
+    result.allocations_per_op = allocations / ops;
+    result.bytes_per_op = allocated_bytes / ops;
+    return result;
+}
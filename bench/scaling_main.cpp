@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "bench.h"
+
+/**
+ * Thread scaling of the benchmark cases: every thread formats the same number of rows, so with no
+ * shared state the wall time stays flat and the throughput grows with the thread count.
+ * Usage: my_format_scaling [--iterations N] [--threads N] [--filter scenario] [--min-efficiency percent]
+ * With --min-efficiency the exit status is 1 when a cpp17 case scales below that percentage at the most threads
+ */
+
+int main(int argc, char** argv)
+{
+    int iterations = 200000;
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string filter = "int";
+    double min_efficiency = 0;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (std::strcmp(argv[i], "--iterations") == 0)
+        {
+            iterations = std::atoi(argv[i + 1]);
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0)
+        {
+            max_threads = std::atoi(argv[i + 1]);
+        }
+        else if (std::strcmp(argv[i], "--filter") == 0)
+        {
+            filter = argv[i + 1];
+        }
+        else if (std::strcmp(argv[i], "--min-efficiency") == 0)
+        {
+            min_efficiency = std::atof(argv[i + 1]);
+        }
+    }
+
+    // 1, 2, 4, ... and max_threads itself
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2)
+    {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::vector<Case> cases;
+    for (auto& c : AllCases())
+    {
+        if (c.scenario == filter)
+        {
+            cases.push_back(c);
+        }
+    }
+
+    bool scaled = true;
+    std::printf("%-10s %-22s %14s %10s %12s\n", "threads", "impl", "rows/s", "speedup", "efficiency");
+    for (auto& c : cases)
+    {
+        double single = 0;
+        for (int threads : thread_counts)
+        {
+            double throughput = Measure(c, iterations, threads).ops_per_second;
+            if (threads == 1)
+            {
+                single = throughput;
+            }
+            double speedup = throughput / single;
+            double efficiency = speedup / threads * 100;
+            std::printf("%-10d %-22s %14.0f %10.2f %11.1f%%\n", threads, c.impl.c_str(), throughput, speedup,
+                        efficiency);
+            if (threads == max_threads and c.impl.rfind("cpp17", 0) == 0 and efficiency < min_efficiency)
+            {
+                scaled = false;
+            }
+        }
+    }
+    return scaled ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+#include "my_format_binlog.h"
+
+/**
+ * Decode a binary log written by BinaryLogWriter into text, one line per record
+ * Usage: my_format_binlog_decode <file>
+ */
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <file>" << endl;
+        return 1;
+    }
+    FILE* file = std::fopen(argv[1], "rb");
+    if (file == nullptr)
+    {
+        std::cerr << "Can not open " << argv[1] << endl;
+        return 1;
+    }
+    string data;
+    char chunk[64 * 1024];
+    size_t size;
+    while ((size = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        data.append(chunk, size);
+    }
+    std::fclose(file);
+
+    MemoryWriter writer;
+    size_t line_begin = 0;
+    try
+    {
+        BinaryLogReader reader(data);
+        while (reader.Next(writer))
+        {
+            writer.Append('\n');
+            if (writer.Size() >= 64 * 1024)
+            {
+                std::fwrite(writer.Data(), 1, writer.Size(), stdout);
+                writer.Clear();
+            }
+            line_begin = writer.Size();
+        }
+        std::fwrite(writer.Data(), 1, writer.Size(), stdout);
+    }
+    catch (const char* error)
+    {
+        // the records before the bad one are still written, without the partial line of the bad one
+        writer.Resize(line_begin);
+        std::fwrite(writer.Data(), 1, writer.Size(), stdout);
+        std::fflush(stdout);
+        std::cerr << error << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,5 +1,4 @@
-#include <iostream>
-#include "my_format_cpp11.h"
+#include "my_format_cpp17.h"
 
 class Object
 {
@@ -25,6 +24,12 @@ public:
                ",motion=" + motion_type;
     }
 
+    // Preferred over ToString(), it appends straight into the output without a temporary string
+    void FormatTo(Writer& writer, const Parser::FormatInfo& format_info) const
+    {
+        ::FormatTo(writer, FORMAT_STRING("x={:.6f},y={:.6f},motion={}"), x, y, motion_type);
+    }
+
 private:
     float x = 10;
     float y = 1;
@@ -35,7 +40,8 @@ int main()
 {
     Object o;
     Track t;
-    std::cout << Format("Very Good {1:.3f} we make it { {} {0} {3} {2}", 1, 2.0, o, t) << endl;
-    std::cout << Format("") << endl;
-    std::cout << Format("{1:.5f}", 0, 2.0f) << endl;
+    Print(stdout, "Very Good {1:.3f} we make it { {} {0} {3} {2}\n", 1, 2.0, o, t);
+    Print(stdout, "\n");
+    Print(stdout, "{1:.5f}\n", 0, 2.0f);
+    Print(stdout, FORMAT_STRING("Very Good {1:.3f} we make it { {} {0} {3} {2}\n"), 1, 2.0, o, t);
 }
\ No newline at end of file
@@ -0,0 +1,483 @@
+#pragma once
+
+#include "my_format_cpp17.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <new>
+#include <thread>
+
+/**
+ * Specialize with value = true for a custom type that AsyncLogger may copy and render later on its own thread.
+ * Being trivially copyable is not enough: the copy must not point into other memory, e.g. through a
+ * const char* or a std::string_view, since the caller may free or change it before the line is written.
+ * The type must be trivially copyable and have FormatTo()
+ */
+template<typename T>
+struct AsyncSnapshot : std::false_type
+{
+};
+
+/**
+ * Asynchronous logging frontend.
+ * A log call only copies the template and the captured arguments into a ring buffer owned by the
+ * calling thread, a background thread renders the records with Render() and writes them as lines.
+ *
+ * Strings are copied into the record. A custom type for which AsyncSnapshot is specialized is copied
+ * byte by byte and rendered later, any other custom type is rendered on the calling thread
+ * (with the spec of its {***}) so that the record never points into the caller's objects.
+ * A runtime template is parsed by Log() through FormatCache::Local(), so a bad template throws to the caller,
+ * and the record holds the parsed template. An exception while a record is rendered replaces its line.
+ * When the ring of a thread is full the record is dropped and counted, the caller never blocks.
+ */
+class AsyncLogger
+{
+public:
+    explicit AsyncLogger(FILE* file = stdout, size_t ring_size = 1 << 20)
+            : file_(file), ring_size_(AlignUp(std::max<size_t>(ring_size, 4096), kRecordAlign)),
+              id_(NextId()), consumer_([this] { Consume(); })
+    {
+    }
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    ~AsyncLogger()
+    {
+        stop_.store(true, std::memory_order_release);
+        consumer_.join();
+    }
+
+    /**
+     * Queue one line, fmt may be a string, a CompiledFormat or a FORMAT_STRING.
+     * Return false if the record was dropped
+     */
+    template<typename FormatString, typename... Args>
+    bool Log(const FormatString& fmt, Args&& ...args)
+    {
+        if constexpr (not std::is_base_of_v<CompileTimeFormatString, FormatString> and
+                      not std::is_same_v<FormatString, CompiledFormat>)
+        {
+            // parsed on the calling thread, so that a bad template throws here like Format() does
+            return Log(*FormatCache::Local().Get(fmt), std::forward<Args>(args)...);
+        }
+        constexpr size_t arg_num = sizeof...(Args);
+        auto args_data = CaptureArgs(std::forward<Args>(args)...);
+        constexpr std::array<size_t, arg_num> snapshot_sizes = {SnapshotSize<std::decay_t<Args>>()...};
+
+        // custom arguments that can not be copied safely are rendered now, with the spec of their {***}
+        std::array<bool, arg_num> eager_args{};
+        bool any_eager = false;
+        for (size_t i = 0; i < arg_num; i++)
+        {
+            auto type = args_data[i].data_type;
+            eager_args[i] = (type == DataType::kCustom and snapshot_sizes[i] == 0) or type == DataType::kCustomToString;
+            any_eager = any_eager or eager_args[i];
+        }
+        MemoryWriter eager;
+        std::array<pair<size_t, size_t>, arg_num> eager_ranges{};
+        ArgRenderer arg_renderer(ArgList{args_data.data(), args_data.size()});
+        if (any_eager and not RenderReferencedArgs(eager, arg_renderer, fmt, eager_args, eager_ranges))
+        {
+            // one argument with two specs, the whole line is rendered now and queued as text
+            eager.Clear();
+            RenderSegments(eager, arg_renderer, fmt);
+            return Log("{}", std::string_view(eager.Data(), eager.Size()));
+        }
+
+        std::string_view template_str;
+        const Parser::FormatInfo* format_infos = nullptr;
+        size_t format_info_num = 0;
+        RenderFunction render = &RenderCompiled;
+        if constexpr (std::is_base_of_v<CompileTimeFormatString, FormatString>)
+        {
+            render = &RenderStatic<FormatString>;
+        }
+        else if constexpr (std::is_same_v<FormatString, CompiledFormat>)
+        {
+            template_str = fmt.Str();
+            format_infos = fmt.FormatInfos().data();
+            format_info_num = fmt.FormatInfos().size();
+        }
+
+        // layout: RecordHeader, ArgData[arg_num], FormatInfo[format_info_num], template, payload of strings and objects
+        size_t args_offset = AlignUp(sizeof(RecordHeader), alignof(ArgData));
+        size_t size = args_offset + sizeof(ArgData) * arg_num + sizeof(Parser::FormatInfo) * format_info_num +
+                      template_str.size();
+        for (size_t i = 0; i < arg_num; i++)
+        {
+            size = AlignUp(size, kRecordAlign) + PayloadSize(args_data[i], snapshot_sizes[i], eager_ranges[i]);
+        }
+        size = AlignUp(size, kRecordAlign);
+
+        Ring& ring = LocalRing();
+        char* record = ring.Reserve(size);
+        if (record == nullptr)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        auto* header = reinterpret_cast<RecordHeader*>(record);
+        header->size = size;
+        header->arg_num = arg_num;
+        header->template_size = template_str.size();
+        header->format_info_num = format_info_num;
+        header->render = render;
+        auto* record_args = reinterpret_cast<ArgData*>(record + args_offset);
+        size_t offset = args_offset + sizeof(ArgData) * arg_num;
+        // the template is stored parsed, the consumer does not parse it again
+        if (format_info_num != 0)
+        {
+            std::memcpy(record + offset, format_infos, sizeof(Parser::FormatInfo) * format_info_num);
+            offset += sizeof(Parser::FormatInfo) * format_info_num;
+        }
+        // a FORMAT_STRING is not copied, its template_str is empty and has no data
+        if (not template_str.empty())
+        {
+            std::memcpy(record + offset, template_str.data(), template_str.size());
+            offset += template_str.size();
+        }
+
+        // pointers are stored as offsets from the record, the consumer turns them back into pointers
+        for (size_t i = 0; i < arg_num; i++)
+        {
+            ArgData arg = args_data[i];
+            offset = AlignUp(offset, kRecordAlign);
+            size_t payload_size = PayloadSize(arg, snapshot_sizes[i], eager_ranges[i]);
+            if (arg.data_type == DataType::kString or arg.data_type == DataType::kBytes)
+            {
+                // an empty string_view may have no data at all
+                if (payload_size != 0)
+                {
+                    std::memcpy(record + offset, arg.data.str_data.data, payload_size);
+                }
+                arg.data.str_data.data = reinterpret_cast<const char*>(static_cast<uintptr_t>(offset));
+            }
+            else if (arg.data_type == DataType::kCustom and snapshot_sizes[i] != 0)
+            {
+                std::memcpy(record + offset, arg.data.custom_data.object, payload_size);
+                arg.data.custom_data.object = reinterpret_cast<const void*>(static_cast<uintptr_t>(offset));
+            }
+            else if (arg.data_type == DataType::kCustom or arg.data_type == DataType::kCustomToString)
+            {
+                std::memcpy(record + offset, eager.Data() + eager_ranges[i].first, payload_size);
+                arg.data.str_data = {reinterpret_cast<const char*>(static_cast<uintptr_t>(offset)), payload_size};
+                arg.data_type = DataType::kString;
+            }
+            record_args[i] = arg;
+            offset += payload_size;
+        }
+        ring.Commit(size);
+        return true;
+    }
+
+    /**
+     * Block until every line queued before this call is written and the file is flushed
+     */
+    void Flush()
+    {
+        // two full rounds of the consumer guarantee that one of them started after this call
+        auto target = drained_rounds_.load(std::memory_order_acquire) + 2;
+        while (drained_rounds_.load(std::memory_order_acquire) < target)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    /**
+     * Number of lines dropped because the ring of their thread was full
+     */
+    size_t DroppedCount() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t kRecordAlign = 16;
+    static constexpr uint32_t kPadding = UINT32_MAX;
+
+    using RenderFunction = void (*)(Writer& writer, std::string_view template_str,
+                                    const Parser::FormatInfo* format_infos, size_t format_info_num, ArgList args);
+
+    struct RecordHeader
+    {
+        // bytes of the whole record, including the header
+        uint32_t size;
+        // kPadding marks the unused end of the ring before it wraps
+        uint32_t arg_num;
+        uint32_t template_size;
+        uint32_t format_info_num;
+        RenderFunction render;
+    };
+
+    /**
+     * Single producer single consumer ring of records, records never wrap around the end
+     */
+    class Ring
+    {
+    public:
+        explicit Ring(size_t capacity)
+                : buffer_(static_cast<char*>(::operator new(capacity, std::align_val_t(64)))), capacity_(capacity)
+        {
+        }
+
+        ~Ring()
+        {
+            ::operator delete(buffer_, std::align_val_t(64));
+        }
+
+        // producer side
+        char* Reserve(size_t size)
+        {
+            size_t head = head_.load(std::memory_order_relaxed);
+            size_t contiguous = capacity_ - head % capacity_;
+            padding_ = contiguous < size ? contiguous : 0;
+            if (head + padding_ + size - cached_tail_ > capacity_)
+            {
+                cached_tail_ = tail_.load(std::memory_order_acquire);
+                if (head + padding_ + size - cached_tail_ > capacity_)
+                {
+                    return nullptr;
+                }
+            }
+            if (padding_ != 0)
+            {
+                auto* header = reinterpret_cast<RecordHeader*>(buffer_ + head % capacity_);
+                header->size = padding_;
+                header->arg_num = kPadding;
+            }
+            return buffer_ + (head + padding_) % capacity_;
+        }
+
+        void Commit(size_t size)
+        {
+            head_.store(head_.load(std::memory_order_relaxed) + padding_ + size, std::memory_order_release);
+        }
+
+        // consumer side, return whether any record was handled
+        template<typename OnRecord>
+        bool Drain(OnRecord&& on_record)
+        {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t head = head_.load(std::memory_order_acquire);
+            if (tail == head)
+            {
+                return false;
+            }
+            while (tail != head)
+            {
+                char* record = buffer_ + tail % capacity_;
+                auto* header = reinterpret_cast<RecordHeader*>(record);
+                if (header->arg_num != kPadding)
+                {
+                    on_record(record);
+                }
+                tail += header->size;
+            }
+            tail_.store(tail, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        char* buffer_;
+        size_t capacity_;
+        size_t padding_ = 0;
+        size_t cached_tail_ = 0;
+        alignas(64) std::atomic<size_t> head_{0};
+        alignas(64) std::atomic<size_t> tail_{0};
+    };
+
+    static constexpr size_t AlignUp(size_t value, size_t align)
+    {
+        return (value + align - 1) / align * align;
+    }
+
+    static uint64_t NextId()
+    {
+        static std::atomic<uint64_t> next_id{1};
+        return next_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * sizeof(T) if a T argument can be copied into the record and rendered later, otherwise 0
+     */
+    template<typename T>
+    static constexpr size_t SnapshotSize()
+    {
+        if constexpr (AsyncSnapshot<T>::value)
+        {
+            static_assert(HasFormatTo<T>::value and std::is_trivially_copyable<T>::value,
+                          "AsyncSnapshot needs a trivially copyable type with FormatTo()");
+            static_assert(alignof(T) <= kRecordAlign, "AsyncSnapshot type is aligned more than a record");
+            return sizeof(T);
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    static size_t PayloadSize(const ArgData& arg, size_t snapshot_size, pair<size_t, size_t> eager_range)
+    {
+        if (arg.data_type == DataType::kString or arg.data_type == DataType::kBytes)
+        {
+            return arg.data.str_data.size;
+        }
+        if (arg.data_type == DataType::kCustom and snapshot_size != 0)
+        {
+            return snapshot_size;
+        }
+        if (arg.data_type == DataType::kCustom or arg.data_type == DataType::kCustomToString)
+        {
+            return eager_range.second - eager_range.first;
+        }
+        return 0;
+    }
+
+    static void RenderCompiled(Writer& writer, std::string_view template_str,
+                               const Parser::FormatInfo* format_infos, size_t format_info_num, ArgList args)
+    {
+        Render(writer, template_str, format_infos, format_info_num, args);
+    }
+
+    template<typename S>
+    static void RenderStatic(Writer& writer, std::string_view template_str,
+                             const Parser::FormatInfo* format_infos, size_t format_info_num, ArgList args)
+    {
+        Render(writer, S{}, args);
+    }
+
+    Ring& LocalRing()
+    {
+        // one ring per thread and logger, the lock is only taken the first time a thread logs.
+        // The logger owns the rings: the thread keeps a weak_ptr, so a destroyed logger frees its rings,
+        // and a raw pointer, which is valid while id_ matches since ids are never reused
+        struct LocalRingEntry
+        {
+            uint64_t logger_id;
+            Ring* ring;
+            std::weak_ptr<Ring> owner;
+        };
+        thread_local vector<LocalRingEntry> local_rings;
+        for (auto& local_ring : local_rings)
+        {
+            if (local_ring.logger_id == id_)
+            {
+                return *local_ring.ring;
+            }
+        }
+        // entries of destroyed loggers are dropped when the thread meets a new one
+        local_rings.erase(std::remove_if(local_rings.begin(), local_rings.end(),
+                                         [](const LocalRingEntry& entry) { return entry.owner.expired(); }),
+                          local_rings.end());
+        auto ring = std::make_shared<Ring>(ring_size_);
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings_.push_back(ring);
+        }
+        local_rings.push_back({id_, ring.get(), ring});
+        return *ring;
+    }
+
+    void Consume()
+    {
+        MemoryWriter writer;
+        vector<std::shared_ptr<Ring>> rings;
+        while (true)
+        {
+            bool stopping = stop_.load(std::memory_order_acquire);
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex_);
+                rings = rings_;
+            }
+            bool any = false;
+            for (auto& ring : rings)
+            {
+                any |= ring->Drain([this, &writer](char* record) { WriteRecord(writer, record); });
+            }
+            // WriteRecord() leaves the text in writer, flush what is left of this round
+            Output(writer);
+            std::fflush(file_);
+            drained_rounds_.fetch_add(1, std::memory_order_release);
+            if (stopping and not any)
+            {
+                break;
+            }
+            if (not any)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    }
+
+    void Output(MemoryWriter& writer)
+    {
+        std::fwrite(writer.Data(), 1, writer.Size(), file_);
+        writer.Clear();
+    }
+
+    static void FailLine(MemoryWriter& writer, size_t line_begin, const char* error)
+    {
+        writer.Resize(line_begin);
+        writer.Append("[format error: ");
+        writer.Append(error);
+        writer.Append(']');
+    }
+
+    void WriteRecord(MemoryWriter& writer, char* record)
+    {
+        auto* header = reinterpret_cast<RecordHeader*>(record);
+        auto* args = reinterpret_cast<ArgData*>(record + AlignUp(sizeof(RecordHeader), alignof(ArgData)));
+        for (uint32_t i = 0; i < header->arg_num; i++)
+        {
+            if (args[i].data_type == DataType::kString or args[i].data_type == DataType::kBytes)
+            {
+                args[i].data.str_data.data = record + reinterpret_cast<uintptr_t>(args[i].data.str_data.data);
+            }
+            else if (args[i].data_type == DataType::kCustom)
+            {
+                args[i].data.custom_data.object = record + reinterpret_cast<uintptr_t>(args[i].data.custom_data.object);
+            }
+        }
+        auto* format_infos = reinterpret_cast<Parser::FormatInfo*>(args + header->arg_num);
+        std::string_view template_str(reinterpret_cast<char*>(format_infos + header->format_info_num),
+                                      header->template_size);
+        size_t line_begin = writer.Size();
+        try
+        {
+            header->render(writer, template_str, format_infos, header->format_info_num,
+                           ArgList{args, header->arg_num});
+        }
+        catch (const char* error)
+        {
+            // e.g. a FormatTo() of a snapshot, the line is replaced and the consumer keeps running
+            FailLine(writer, line_begin, error);
+        }
+        catch (const std::exception& error)
+        {
+            FailLine(writer, line_begin, error.what());
+        }
+        catch (...)
+        {
+            FailLine(writer, line_begin, "unknown exception");
+        }
+        writer.Append('\n');
+        if (writer.Size() >= 64 * 1024)
+        {
+            Output(writer);
+        }
+    }
+
+    FILE* file_;
+    size_t ring_size_;
+    uint64_t id_;
+    std::atomic<bool> stop_{false};
+    std::atomic<size_t> dropped_{0};
+    std::atomic<uint64_t> drained_rounds_{0};
+    std::mutex rings_mutex_;
+    vector<std::shared_ptr<Ring>> rings_;
+    // declared last, it starts after everything above is constructed
+    std::thread consumer_;
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "my_format_cpp17.h"
+
+#include <cstdio>
+
+/**
+ * Binary log format: instead of rendered text, a record holds the id of its template and the raw
+ * argument values, the text is only rendered when the log is decoded by BinaryLogReader.
+ *
+ * Layout, numbers are in host byte order:
+ *   "MYFMTBL1"
+ *   'T' u32 template_id u32 size bytes[size]     defines a template, written before its first record
+ *   'R' u32 template_id u32 arg_num args...      one record
+ * Each argument is a u8 DataType followed by the bytes of its ArgData::Data member,
+ * kString and kBytes are a u32 size followed by the bytes. Custom types are rendered to text when logged,
+ * with the spec of the {***} that references them.
+ */
+namespace binlog
+{
+constexpr char kMagic[8] = {'M', 'Y', 'F', 'M', 'T', 'B', 'L', '1'};
+constexpr char kTemplateTag = 'T';
+constexpr char kRecordTag = 'R';
+}
+
+/**
+ * Writes a binary log to a FILE*, it is not thread-safe: use one writer per thread or lock around Log()
+ */
+class BinaryLogWriter
+{
+public:
+    explicit BinaryLogWriter(FILE* file) : file_(file)
+    {
+        buffer_.Append(binlog::kMagic, sizeof(binlog::kMagic));
+    }
+
+    BinaryLogWriter(const BinaryLogWriter&) = delete;
+    BinaryLogWriter& operator=(const BinaryLogWriter&) = delete;
+
+    ~BinaryLogWriter()
+    {
+        Flush();
+    }
+
+    /**
+     * Append one record, fmt may be a string, a CompiledFormat or a FORMAT_STRING
+     */
+    template<typename FormatString, typename... Args>
+    void Log(const FormatString& fmt, Args&& ...args)
+    {
+        auto args_data = CaptureArgs(std::forward<Args>(args)...);
+        ArgRenderer arg_renderer(ArgList{args_data.data(), args_data.size()});
+
+        // custom objects go into the log as text, rendered with the spec of their {***}
+        std::array<bool, sizeof...(Args)> custom_args{};
+        bool any_custom = false;
+        for (size_t i = 0; i < args_data.size(); i++)
+        {
+            auto type = args_data[i].data_type;
+            custom_args[i] = type == DataType::kCustom or type == DataType::kCustomToString;
+            any_custom = any_custom or custom_args[i];
+        }
+        std::array<pair<size_t, size_t>, sizeof...(Args)> custom_ranges{};
+        scratch_.Clear();
+        if (any_custom and not RenderReferencedArgs(scratch_, arg_renderer, fmt, custom_args, custom_ranges))
+        {
+            // one argument with two specs, the whole line goes into the log as text
+            scratch_.Clear();
+            RenderSegments(scratch_, arg_renderer, fmt);
+            Log("{}", std::string_view(scratch_.Data(), scratch_.Size()));
+            return;
+        }
+
+        uint32_t template_id = 0;
+        if constexpr (std::is_base_of_v<CompileTimeFormatString, FormatString>)
+        {
+            // the static table of a FORMAT_STRING never moves, so its address is the key
+            template_id = TemplateId(StaticFormat<FormatString>::str.data(), StaticFormat<FormatString>::str);
+        }
+        else if constexpr (std::is_same_v<FormatString, CompiledFormat>)
+        {
+            template_id = TemplateId(nullptr, fmt.Str());
+        }
+        else
+        {
+            template_id = TemplateId(nullptr, fmt);
+        }
+
+        buffer_.Append(binlog::kRecordTag);
+        AppendU32(template_id);
+        AppendU32(args_data.size());
+        for (size_t i = 0; i < args_data.size(); i++)
+        {
+            if (custom_args[i])
+            {
+                size_t size = custom_ranges[i].second - custom_ranges[i].first;
+                buffer_.Append(static_cast<char>(DataType::kString));
+                AppendU32(size);
+                buffer_.Append(scratch_.Data() + custom_ranges[i].first, size);
+            }
+            else
+            {
+                AppendArg(args_data[i]);
+            }
+        }
+        if (buffer_.Size() >= kFlushSize)
+        {
+            Flush();
+        }
+    }
+
+    void Flush()
+    {
+        std::fwrite(buffer_.Data(), 1, buffer_.Size(), file_);
+        std::fflush(file_);
+        buffer_.Clear();
+    }
+
+private:
+    static constexpr size_t kFlushSize = 64 * 1024;
+
+    void AppendU32(uint32_t value)
+    {
+        buffer_.Append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    uint32_t TemplateId(const char* static_key, std::string_view template_str)
+    {
+        if (static_key != nullptr)
+        {
+            auto it = static_ids_.find(static_key);
+            if (it != static_ids_.end())
+            {
+                return it->second;
+            }
+        }
+        auto it = ids_.find(template_str);
+        if (it == ids_.end())
+        {
+            if (static_key == nullptr)
+            {
+                // a runtime template is parsed once here, so that a bad one throws to the caller
+                // instead of making the whole log undecodable
+                Parser::ForEachField(template_str, [](const Parser::FormatInfo&) {});
+            }
+            templates_.emplace_back(template_str);
+            it = ids_.emplace(templates_.back(), templates_.size() - 1).first;
+            buffer_.Append(binlog::kTemplateTag);
+            AppendU32(it->second);
+            AppendU32(template_str.size());
+            buffer_.Append(template_str);
+        }
+        if (static_key != nullptr)
+        {
+            static_ids_.emplace(static_key, it->second);
+        }
+        return it->second;
+    }
+
+    void AppendArg(const ArgData& arg)
+    {
+        buffer_.Append(static_cast<char>(arg.data_type));
+        switch (arg.data_type)
+        {
+            case DataType::kBool:
+                buffer_.Append(static_cast<char>(arg.data.bool_data));
+                break;
+            case DataType::kChar:
+                buffer_.Append(arg.data.char_data);
+                break;
+            case DataType::kInt:
+            case DataType::kUInt:
+            case DataType::kFloat:
+                buffer_.Append(reinterpret_cast<const char*>(&arg.data), 4);
+                break;
+            case DataType::kInt64:
+            case DataType::kUInt64:
+            case DataType::kDouble:
+                buffer_.Append(reinterpret_cast<const char*>(&arg.data), 8);
+                break;
+            case DataType::kString:
+            case DataType::kBytes:
+                AppendU32(arg.data.str_data.size);
+                buffer_.Append(arg.data.str_data.data, arg.data.str_data.size);
+                break;
+            default:
+                break;
+        }
+    }
+
+    FILE* file_;
+    MemoryWriter buffer_;
+    MemoryWriter scratch_;
+    // std::list keeps the keys of ids_ valid
+    std::list<string> templates_;
+    std::unordered_map<std::string_view, uint32_t> ids_;
+    std::unordered_map<const char*, uint32_t> static_ids_;
+};
+
+/**
+ * Reads a binary log and renders its records as text with the same Parser and Render() as Format()
+ */
+class BinaryLogReader
+{
+public:
+    /**
+     * data must hold a whole log, it is referenced and not copied
+     */
+    explicit BinaryLogReader(std::string_view data) : data_(data)
+    {
+        if (data_.size() < sizeof(binlog::kMagic) or
+            std::memcmp(data_.data(), binlog::kMagic, sizeof(binlog::kMagic)) != 0)
+        {
+            throw "Invalid binary log";
+        }
+        position_ = sizeof(binlog::kMagic);
+    }
+
+    /**
+     * Render the next record into writer, return false at the end of the log
+     */
+    bool Next(Writer& writer)
+    {
+        while (position_ < data_.size())
+        {
+            char tag = data_[position_++];
+            uint32_t id = ReadU32();
+            if (tag == binlog::kTemplateTag)
+            {
+                uint32_t size = ReadU32();
+                if (id != templates_.size())
+                {
+                    throw "Invalid binary log";
+                }
+                templates_.emplace_back(string(ReadBytes(size), size));
+                continue;
+            }
+            if (tag != binlog::kRecordTag or id >= templates_.size())
+            {
+                throw "Invalid binary log";
+            }
+            uint32_t arg_num = ReadU32();
+            args_data_.resize(arg_num);
+            for (auto& arg : args_data_)
+            {
+                ReadArg(arg);
+            }
+            Render(writer, templates_[id], ArgList{args_data_.data(), args_data_.size()});
+            return true;
+        }
+        return false;
+    }
+
+private:
+    const char* ReadBytes(size_t size)
+    {
+        if (data_.size() - position_ < size)
+        {
+            throw "Truncated binary log";
+        }
+        const char* bytes = data_.data() + position_;
+        position_ += size;
+        return bytes;
+    }
+
+    uint32_t ReadU32()
+    {
+        uint32_t value;
+        std::memcpy(&value, ReadBytes(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    void ReadArg(ArgData& arg)
+    {
+        arg.data_type = static_cast<DataType>(*ReadBytes(1));
+        switch (arg.data_type)
+        {
+            case DataType::kBool:
+                arg.data.bool_data = *ReadBytes(1) != 0;
+                break;
+            case DataType::kChar:
+                arg.data.char_data = *ReadBytes(1);
+                break;
+            case DataType::kInt:
+            case DataType::kUInt:
+            case DataType::kFloat:
+                std::memcpy(&arg.data, ReadBytes(4), 4);
+                break;
+            case DataType::kInt64:
+            case DataType::kUInt64:
+            case DataType::kDouble:
+                std::memcpy(&arg.data, ReadBytes(8), 8);
+                break;
+            case DataType::kString:
+            case DataType::kBytes:
+            {
+                uint32_t size = ReadU32();
+                arg.data.str_data = {ReadBytes(size), size};
+                break;
+            }
+            default:
+                throw "Invalid binary log";
+        }
+    }
+
+    std::string_view data_;
+    size_t position_ = 0;
+    vector<CompiledFormat> templates_;
+    vector<ArgData> args_data_;
+};
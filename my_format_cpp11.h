@@ -6,6 +6,8 @@
 #include <unordered_map>
 #include <map>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 
 using std::vector;
 using std::string;
@@ -41,7 +43,11 @@ struct HasToString
 enum class DataType
 {
     kBool,
+    kChar,
     kInt,
+    kUInt,
+    kInt64,
+    kUInt64,
     kFloat,
     kDouble,
     kString,
@@ -53,7 +59,11 @@ struct ArgData
     union Data
     {
         bool bool_data;
+        char char_data;
         int int_data;
+        unsigned int uint_data;
+        int64_t int64_data;
+        uint64_t uint64_data;
         float float_data;
         double double_data;
     };
@@ -102,23 +112,66 @@ Decode(ArgData& arg_data, T&& t)
 }
 
 /**
- * if arg is not a class type, then this function will be generated and executed
+ * Check whether a type is an integer type other than bool
  */
 template<typename T>
-typename std::enable_if<!std::is_class<RemoveConstRefType<T>>::value, void>::type
+struct IsInteger
+{
+    enum
+    {
+        value = std::is_integral<T>::value && !std::is_same<T, bool>::value
+    };
+};
+
+/**
+ * if arg is an integer type, then this function will be generated and executed
+ * integers narrower than int are widened, the rest keep their width and signedness
+ */
+template<typename T>
+typename std::enable_if<IsInteger<RemoveConstRefType<T>>::value, void>::type
 Decode(ArgData& arg_data, T t)
 {
     using Type = RemoveConstRefType<T>;
-    if (std::is_same<Type, bool>::value)
+    if (std::is_same<Type, char>::value)
     {
-        arg_data.data.bool_data = t;
-        arg_data.data_type = DataType::kBool;
+        arg_data.data.char_data = t;
+        arg_data.data_type = DataType::kChar;
     }
-    else if (std::is_same<Type, int>::value)
+    else if (std::is_signed<Type>::value and sizeof(Type) <= sizeof(int))
     {
         arg_data.data.int_data = t;
         arg_data.data_type = DataType::kInt;
     }
+    else if (std::is_signed<Type>::value)
+    {
+        arg_data.data.int64_data = t;
+        arg_data.data_type = DataType::kInt64;
+    }
+    else if (sizeof(Type) <= sizeof(unsigned int))
+    {
+        arg_data.data.uint_data = t;
+        arg_data.data_type = DataType::kUInt;
+    }
+    else
+    {
+        arg_data.data.uint64_data = t;
+        arg_data.data_type = DataType::kUInt64;
+    }
+}
+
+/**
+ * if arg is not a class type nor an integer type, then this function will be generated and executed
+ */
+template<typename T>
+typename std::enable_if<!std::is_class<RemoveConstRefType<T>>::value && !IsInteger<RemoveConstRefType<T>>::value, void>::type
+Decode(ArgData& arg_data, T t)
+{
+    using Type = RemoveConstRefType<T>;
+    if (std::is_same<Type, bool>::value)
+    {
+        arg_data.data.bool_data = t;
+        arg_data.data_type = DataType::kBool;
+    }
     else if (std::is_same<Type, float>::value)
     {
         arg_data.data.float_data = t;
@@ -144,7 +197,7 @@ Decode(ArgData& arg_data, T t)
 /**
  * Function for terminate extract argument package
  */
-void Unpack(vector<ArgData>& args_data, int arg_index)
+inline void Unpack(vector<ArgData>& args_data, int arg_index)
 {
 }
 
@@ -299,6 +352,59 @@ public:
     }
 };
 
+/**
+ * Write the decimal digits of value so that they end right before end, and return the first digit.
+ * Two digits are converted at a time with a lookup table, without going through the stream locale
+ */
+template<typename UInt>
+char* FormatDecimal(char* end, UInt value)
+{
+    static const char digit_pairs[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    while (value >= 100)
+    {
+        size_t index = static_cast<size_t>(value % 100) * 2;
+        value /= 100;
+        end -= 2;
+        std::memcpy(end, digit_pairs + index, 2);
+    }
+    if (value < 10)
+    {
+        *--end = static_cast<char>('0' + value);
+        return end;
+    }
+    end -= 2;
+    std::memcpy(end, digit_pairs + static_cast<size_t>(value) * 2, 2);
+    return end;
+}
+
+/**
+ * Write an integer in decimal into sbuf
+ */
+template<typename Int>
+void RenderInteger(std::stringstream& sbuf, Int value)
+{
+    typedef typename std::conditional<(sizeof(Int) > sizeof(uint32_t)), uint64_t, uint32_t>::type UInt;
+    char buffer[24];
+    char* end = buffer + sizeof(buffer);
+    UInt abs_value = static_cast<UInt>(value);
+    bool negative = value < 0;
+    if (negative)
+    {
+        abs_value = 0 - abs_value;
+    }
+    char* begin = FormatDecimal(end, abs_value);
+    if (negative)
+    {
+        *--begin = '-';
+    }
+    sbuf.write(begin, end - begin);
+}
+
 /**
  * Format function
  */
@@ -351,27 +457,53 @@ string Format(const string& s, Args&& ...args)
             {
                 sbuf << (arg.data.bool_data ? "true" : "false");
             }
+            else if (arg.data_type == DataType::kChar)
+            {
+                sbuf.put(arg.data.char_data);
+            }
             else if (arg.data_type == DataType::kInt)
             {
-                sbuf << arg.data.int_data;
+                RenderInteger(sbuf, arg.data.int_data);
+            }
+            else if (arg.data_type == DataType::kUInt)
+            {
+                RenderInteger(sbuf, arg.data.uint_data);
+            }
+            else if (arg.data_type == DataType::kInt64)
+            {
+                RenderInteger(sbuf, arg.data.int64_data);
+            }
+            else if (arg.data_type == DataType::kUInt64)
+            {
+                RenderInteger(sbuf, arg.data.uint64_data);
             }
             else if (arg.data_type == DataType::kFloat)
             {
+                // restore the stream state afterwards, so that it does not leak into later arguments
+                std::ios::fmtflags flags = sbuf.flags();
+                std::streamsize precision = sbuf.precision();
                 if (format_info.should_format)
                 {
                     sbuf.setf(std::ios::fixed);
                     sbuf.precision(format_info.fraction_num);
                 }
                 sbuf << arg.data.float_data;
+                sbuf.flags(flags);
+                sbuf.precision(precision);
             }
             else if (arg.data_type == DataType::kDouble)
             {
+                // restore the stream state afterwards, so that it does not leak into later arguments
+                std::ios::fmtflags flags = sbuf.flags();
+                std::streamsize precision = sbuf.precision();
                 if (format_info.should_format)
                 {
                     sbuf.setf(std::ios::fixed);
                     sbuf.precision(format_info.fraction_num);
                 }
                 sbuf << arg.data.double_data;
+                sbuf.flags(flags);
+                sbuf.precision(precision);
             }
             else if (arg.data_type == DataType::kString)
             {
@@ -0,0 +1,320 @@
+#include "my_format_cpp17.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+/**
+ * Render into a string of the exact size. Most output fits the stack buffer and then the result is the only
+ * allocation. Longer output is counted by that first pass, and rendered again into a string reserved to the
+ * counted size. StringWriter checks its bounds, so an argument that writes more the second time only makes it
+ * grow. The arg_renderer keeps ToString() results between the passes
+ */
+template<typename... Template>
+string FormatSegments(std::string_view s, ArgList args, const Template& ...fmt)
+{
+    MY_FORMAT_STATS_RENDER(s, nullptr);
+    ArgRenderer arg_renderer(args);
+    char buffer[MemoryWriter::kInlineSize];
+    TruncatingWriter writer(buffer, sizeof(buffer));
+    RenderSegments(writer, arg_renderer, fmt...);
+    if (writer.Total() <= sizeof(buffer))
+    {
+#if defined(MY_FORMAT_STATS)
+        my_format_stats_scope.AddOutputBytes(writer.Total());
+#endif
+        return string(buffer, writer.Total());
+    }
+
+    string out;
+    out.reserve(writer.Total());
+    {
+        // the writer sets the final size of out when it is destroyed
+        StringWriter out_writer(out);
+        out_writer.Reserve(writer.Total());
+        RenderSegments(out_writer, arg_renderer, fmt...);
+        out_writer.Finish();
+#if defined(MY_FORMAT_STATS)
+        my_format_stats_scope.AddOutputBytes(out_writer.Size());
+#endif
+    }
+    return out;
+}
+
+template<typename... Template>
+size_t SizeSegments(ArgList args, const Template& ...fmt)
+{
+    ArgRenderer arg_renderer(args);
+    size_t size = 0;
+    ForEachSegment(fmt...,
+                   [&size](std::string_view literal) { size += literal.size(); },
+                   [&size, &arg_renderer](const Parser::FormatInfo& format_info) {
+                       size += arg_renderer.Size(format_info);
+                   });
+    // no render follows to charge the capture and ToString() time to
+    MY_FORMAT_STATS_DISCARD_PENDING();
+    return size;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Gathers the output of VPrint for writev: literals point into the template,
+ * arguments are rendered into scratch_ and referenced by offset since scratch_ may grow
+ */
+class FdPrinter
+{
+public:
+    explicit FdPrinter(int fd) : fd_(fd) {}
+
+    void AddLiteral(std::string_view literal)
+    {
+        if (not literal.empty())
+        {
+            AddPiece({literal.data(), 0, literal.size()});
+        }
+    }
+
+    void AddField(ArgRenderer& arg_renderer, const Parser::FormatInfo& format_info)
+    {
+        if (piece_num_ == kMaxPieces)
+        {
+            // flushed before rendering, since Flush() clears scratch_ which the new piece would point into
+            Flush();
+        }
+        size_t offset = scratch_.Size();
+        arg_renderer.Render(scratch_, format_info);
+        size_t size = scratch_.Size() - offset;
+        if (size == 0)
+        {
+            return;
+        }
+        if (piece_num_ > 0 and pieces_[piece_num_ - 1].literal == nullptr and
+            pieces_[piece_num_ - 1].offset + pieces_[piece_num_ - 1].size == offset)
+        {
+            // adjacent arguments, e.g. "{}{}", share one iovec
+            pieces_[piece_num_ - 1].size += size;
+            return;
+        }
+        AddPiece({nullptr, offset, size});
+    }
+
+    /**
+     * Write every pending piece with writev, retrying on partial writes and EINTR
+     */
+    void Flush()
+    {
+        struct iovec iov[kMaxPieces];
+        for (size_t i = 0; i < piece_num_; i++)
+        {
+            auto& piece = pieces_[i];
+            const char* data = piece.literal != nullptr ? piece.literal : scratch_.Data() + piece.offset;
+            iov[i].iov_base = const_cast<char*>(data);
+            iov[i].iov_len = piece.size;
+        }
+
+        struct iovec* first = iov;
+        int count = static_cast<int>(piece_num_);
+        while (count > 0)
+        {
+            ssize_t written = ::writev(fd_, first, count);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw "Failed to write to file descriptor";
+            }
+            size_t left = static_cast<size_t>(written);
+            while (count > 0 and left >= first->iov_len)
+            {
+                left -= first->iov_len;
+                first++;
+                count--;
+            }
+            if (count > 0)
+            {
+                first->iov_base = static_cast<char*>(first->iov_base) + left;
+                first->iov_len -= left;
+            }
+        }
+        piece_num_ = 0;
+        scratch_.Clear();
+    }
+
+private:
+    // a template with more segments is written by several writev calls
+    static constexpr size_t kMaxPieces = 64;
+
+    struct Piece
+    {
+        // nullptr for the bytes at offset in scratch_
+        const char* literal;
+        size_t offset;
+        size_t size;
+    };
+
+    void AddPiece(const Piece& piece)
+    {
+        if (piece_num_ == kMaxPieces)
+        {
+            Flush();
+        }
+        pieces_[piece_num_++] = piece;
+    }
+
+    int fd_;
+    MemoryWriter scratch_;
+    Piece pieces_[kMaxPieces];
+    size_t piece_num_ = 0;
+};
+
+template<typename... Template>
+void PrintSegments(int fd, ArgList args, const Template& ...fmt)
+{
+    ArgRenderer arg_renderer(args);
+    FdPrinter printer(fd);
+    ForEachSegment(fmt...,
+                   [&printer](std::string_view literal) { printer.AddLiteral(literal); },
+                   [&printer, &arg_renderer](const Parser::FormatInfo& format_info) {
+                       printer.AddField(arg_renderer, format_info);
+                   });
+    printer.Flush();
+}
+#endif
+}
+
+void Render(Writer& writer, std::string_view s,
+            const Parser::FormatInfo* format_infos, size_t format_info_num,
+            ArgList args)
+{
+    MY_FORMAT_STATS_RENDER(s, &writer);
+    ArgRenderer arg_renderer(args);
+    RenderSegments(writer, arg_renderer, s, format_infos, format_info_num);
+}
+
+void Render(Writer& writer, std::string_view s, ArgList args)
+{
+    MY_FORMAT_STATS_RENDER(s, &writer);
+    ArgRenderer arg_renderer(args);
+    RenderSegments(writer, arg_renderer, s);
+}
+
+void Render(Writer& writer, const CompiledFormat& format, ArgList args)
+{
+    Render(writer, format.Str(), format.FormatInfos().data(), format.FormatInfos().size(), args);
+}
+
+string VFormat(std::string_view s, const Parser::FormatInfo* format_infos, size_t format_info_num, ArgList args)
+{
+    return FormatSegments(s, args, s, format_infos, format_info_num);
+}
+
+string VFormat(std::string_view s, ArgList args)
+{
+    return FormatSegments(s, args, s);
+}
+
+string VFormat(const CompiledFormat& format, ArgList args)
+{
+    return VFormat(format.Str(), format.FormatInfos().data(), format.FormatInfos().size(), args);
+}
+
+size_t VFormattedSize(std::string_view s, const Parser::FormatInfo* format_infos, size_t format_info_num,
+                      ArgList args)
+{
+    return SizeSegments(args, s, format_infos, format_info_num);
+}
+
+size_t VFormattedSize(std::string_view s, ArgList args)
+{
+    return SizeSegments(args, s);
+}
+
+size_t VFormattedSize(const CompiledFormat& format, ArgList args)
+{
+    return VFormattedSize(format.Str(), format.FormatInfos().data(), format.FormatInfos().size(), args);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+void VPrint(int fd, std::string_view s, const Parser::FormatInfo* format_infos, size_t format_info_num,
+            ArgList args)
+{
+    MY_FORMAT_STATS_RENDER(s, nullptr);
+    PrintSegments(fd, args, s, format_infos, format_info_num);
+}
+
+void VPrint(int fd, std::string_view s, ArgList args)
+{
+    MY_FORMAT_STATS_RENDER(s, nullptr);
+    PrintSegments(fd, args, s);
+}
+
+void VPrint(int fd, const CompiledFormat& format, ArgList args)
+{
+    VPrint(fd, format.Str(), format.FormatInfos().data(), format.FormatInfos().size(), args);
+}
+
+void WriteAll(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw "Failed to write to file descriptor";
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+MappedFile::MappedFile(const char* path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        throw "Failed to open file";
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0)
+    {
+        ::close(fd);
+        throw "Failed to open file";
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0)
+    {
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            ::close(fd);
+            throw "Failed to map file";
+        }
+        // a template is read once from the front to the back
+        ::madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(data);
+    }
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_ != nullptr)
+    {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+}
+#endif
@@ -1,11 +1,36 @@
 #pragma once
 
-#include <sstream>
+#include <iostream>
 #include <string>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <tuple>
+#include <array>
+#include <climits>
+#include <type_traits>
 #include <vector>
+#include <deque>
 #include <unordered_map>
 #include <map>
 #include <algorithm>
+#include <limits>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <chrono>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using std::vector;
 using std::string;
@@ -15,339 +40,2947 @@ using std::endl;
 using std::to_string;
 
 /**
- * Check whether a class have member function
- * string ToString();
+ * Output buffer used by Format, bytes are appended directly without iostream.
+ * Subclasses decide where the bytes live by implementing Grow()
  */
-template<typename T>
-struct HasToString
+class Writer
 {
-    typedef char Yes;
-    struct No
+public:
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    virtual ~Writer() = default;
+
+    void Append(const char* data, size_t size)
     {
-        char x[2];
-    };
+        if (capacity_ - size_ >= size)
+        {
+            std::memcpy(data_ + size_, data, size);
+            size_ += size;
+            return;
+        }
+        AppendSlow(data, size);
+    }
 
-    template<typename U, string (U::*)() = &U::ToString>
-    static Yes Check(U*);
+    void Append(std::string_view s)
+    {
+        Append(s.data(), s.size());
+    }
 
-    static No Check(...);
+    void Append(char c)
+    {
+        if (size_ == capacity_)
+        {
+            Grow(size_ + 1);
+        }
+        data_[size_++] = c;
+    }
 
-    enum
+    void Fill(size_t num, char c)
     {
-        value = sizeof(Check(static_cast<T*>(nullptr))) == sizeof(Yes)
-    };
-};
+        while (num > 0)
+        {
+            if (size_ == capacity_)
+            {
+                Grow(size_ + num);
+            }
+            size_t step = std::min(num, capacity_ - size_);
+            std::memset(data_ + size_, c, step);
+            size_ += step;
+            num -= step;
+        }
+    }
 
-enum class DataType
-{
-    kBool,
-    kInt,
-    kFloat,
-    kDouble,
-    kString,
-    kCustom
-};
+    const char* Data() const
+    {
+        return data_;
+    }
 
-struct ArgData
-{
-    union Data
+    size_t Size() const
     {
-        bool bool_data;
-        int int_data;
-        float float_data;
-        double double_data;
-    };
-    Data data;
-    string str_data;
-    DataType data_type;
+        return size_;
+    }
+
+    /**
+     * Bytes appended so far, including those a Grow() handed to their destination.
+     * Unlike Size() it never goes down while rendering, so it measures a field on any writer
+     */
+    size_t Appended() const
+    {
+        return flushed_ + size_;
+    }
+
+protected:
+    Writer(char* data, size_t capacity) : data_(data), capacity_(capacity)
+    {
+    }
+
+    /**
+     * Make room for at least one more byte, either by enlarging the buffer up to min_capacity
+     * or by handing the buffered bytes to their destination and resetting size_
+     */
+    virtual void Grow(size_t min_capacity) = 0;
+
+    char* data_;
+    size_t size_ = 0;
+    size_t capacity_;
+    // bytes that were in the buffer before a Grow() reset size_
+    size_t flushed_ = 0;
+
+private:
+    void AppendSlow(const char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            if (size_ == capacity_)
+            {
+                Grow(size_ + size);
+            }
+            size_t step = std::min(size, capacity_ - size_);
+            std::memcpy(data_ + size_, data, step);
+            size_ += step;
+            data += step;
+            size -= step;
+        }
+    }
 };
 
 /**
- * Function for terminate extract argument package
+ * Writer with an inline stack buffer, only spills to the heap for long output
  */
-void Unpack(vector<ArgData>& args_data, int arg_index)
+class MemoryWriter : public Writer
 {
-}
+public:
+    static constexpr size_t kInlineSize = 500;
+
+    MemoryWriter() : Writer(inline_buffer_, kInlineSize)
+    {
+    }
+
+    ~MemoryWriter() override
+    {
+        if (data_ != inline_buffer_)
+        {
+            delete[] data_;
+        }
+    }
+
+    string Str() const
+    {
+        return string(data_, size_);
+    }
+
+    void Clear()
+    {
+        size_ = 0;
+    }
+
+    /**
+     * Drop the bytes after the first size ones
+     */
+    void Resize(size_t size)
+    {
+        size_ = std::min(size_, size);
+    }
+
+protected:
+    void Grow(size_t min_capacity) override
+    {
+        size_t new_capacity = std::max(capacity_ * 2, min_capacity);
+        char* new_data = new char[new_capacity];
+        std::memcpy(new_data, data_, size_);
+        if (data_ != inline_buffer_)
+        {
+            delete[] data_;
+        }
+        data_ = new_data;
+        capacity_ = new_capacity;
+    }
+
+private:
+    char inline_buffer_[kInlineSize];
+};
 
 /**
- * Function for extract argument package
+ * Writer into caller memory which is known to be large enough
  */
-template<typename FirstArg, typename... TailArgs>
-void Unpack(vector<ArgData>& args_data, int arg_index, FirstArg&& first_arg, TailArgs&& ...tail_args)
+class PointerWriter : public Writer
 {
-    using Type = std::remove_const_t<std::remove_reference_t<FirstArg>>;
-    // id constexpr is a kind of static if in compile time
-    if constexpr (std::is_same<Type, bool>::value)
-    {
-        args_data[arg_index].data.bool_data = first_arg;
-        args_data[arg_index].data_type = DataType::kBool;
-    }
-    else if constexpr (std::is_same<Type, int>::value)
+public:
+    explicit PointerWriter(char* out) : Writer(out, std::numeric_limits<size_t>::max())
     {
-        args_data[arg_index].data.int_data = first_arg;
-        args_data[arg_index].data_type = DataType::kInt;
     }
-    else if constexpr (std::is_same<Type, float>::value)
+
+protected:
+    void Grow(size_t min_capacity) override
     {
-        args_data[arg_index].data.float_data = first_arg;
-        args_data[arg_index].data_type = DataType::kFloat;
     }
-    else if constexpr (std::is_same<Type, double>::value)
+};
+
+/**
+ * Writer into caller memory of a fixed size, the bytes that do not fit are only counted
+ */
+class TruncatingWriter : public Writer
+{
+public:
+    TruncatingWriter(char* buffer, size_t size) : Writer(buffer, size)
     {
-        args_data[arg_index].data.double_data = first_arg;
-        args_data[arg_index].data_type = DataType::kDouble;
     }
-    else if constexpr (std::is_same<std::decay_t<Type>, char const*>::value)
+
+    size_t Written() const
     {
-        args_data[arg_index].str_data = first_arg;
-        args_data[arg_index].data_type = DataType::kString;
+        return truncated_ ? written_ : size_;
     }
-    else if constexpr (std::is_same<Type, std::string>::value)
+
+    size_t Total() const
     {
-        args_data[arg_index].str_data = first_arg;
-        args_data[arg_index].data_type = DataType::kString;
+        return truncated_ ? written_ + discarded_ + size_ : size_;
     }
-    else if constexpr (std::is_class<Type>::value)
+
+protected:
+    void Grow(size_t min_capacity) override
     {
-        if constexpr (HasToString<Type>::value)
+        if (truncated_)
         {
-            args_data[arg_index].str_data = first_arg.ToString();
+            discarded_ += size_;
         }
         else
         {
-            args_data[arg_index].str_data = "?";
+            truncated_ = true;
+            written_ = size_;
         }
-        args_data[arg_index].data_type = DataType::kCustom;
+        data_ = scratch_;
+        capacity_ = sizeof(scratch_);
+        flushed_ += size_;
+        size_ = 0;
     }
-    arg_index++;
-    Unpack(args_data, arg_index, std::forward<TailArgs>(tail_args)...);
-}
+
+private:
+    bool truncated_ = false;
+    size_t written_ = 0;
+    size_t discarded_ = 0;
+    char scratch_[64];
+};
 
 /**
- * This class is used for decode "{0} {} {1:.2f}"
+ * Writer appending to a std::string, the existing capacity of the string is used before it grows.
+ * The string only holds the output after Finish(), otherwise it is restored to its old size
  */
-class Parser
+class StringWriter : public Writer
 {
 public:
-    static pair<int, int> GetNextBrackets(const string& s, int begin_index)
+    explicit StringWriter(string& out) : Writer(nullptr, 0), out_(out), base_(out.size())
     {
-        bool begin_found = false;
-        int begin = s.size();
-        int end = s.size();
-        for (int i = begin_index; i < s.size(); i++)
-        {
-            if (s[i] == '{')
-            {
-                begin = i;
-                begin_found = true;
-            }
-            if (begin_found and s[i] == '}')
-            {
-                end = i;
-                break;
-            }
-        }
-        return {begin, end};
+        // only kInitialSize bytes are made available, resize() writes every byte it adds, so
+        // taking all the spare capacity would cost as much as the capacity instead of the output
+        out_.resize(base_ + kInitialSize);
+        data_ = &out_[base_];
+        capacity_ = out_.size() - base_;
     }
 
-    struct FormatInfo
+    ~StringWriter() override
     {
-        int begin = 0;
-        int end = 0;
-        bool valid = false;
-        bool is_named_index = false;
-        int arg_index;
-        bool should_format = false;
-        int fraction_num = 0;
-    };
+        out_.resize(base_ + (finished_ ? size_ : 0));
+    }
 
-    // 0-for fail 1-success 2-empty
-    static int ParseInteger(const std::string& s, int& result)
+    void Finish()
     {
-        if (s.empty())
-        {
-            return 2;
-        }
-        bool valid = std::find_if(s.begin(), s.end(), [](unsigned char c) { return !std::isdigit(c); }) == s.end();
-        if (valid)
+        finished_ = true;
+    }
+
+    /**
+     * Make room for size bytes of output in one step
+     */
+    void Reserve(size_t size)
+    {
+        if (size > capacity_)
         {
-            result = std::stoi(s);
+            Grow(size);
         }
-        return valid;
     }
 
-    static FormatInfo ParseFormatString(const string& str, int default_arg_index)
+protected:
+    void Grow(size_t min_capacity) override
     {
-        FormatInfo info;
-        info.valid = true;
-        info.arg_index = default_arg_index;
-        info.should_format = false;
+        // doubled from what this writer uses, the bytes before base_ do not count
+        out_.resize(base_ + std::max(min_capacity, capacity_ * 2));
+        data_ = &out_[base_];
+        capacity_ = out_.size() - base_;
+    }
 
-        int colon_pos = -1;
-        int dot_pos = -1;
+private:
+    static constexpr size_t kInitialSize = 128;
 
-        for (int i = 0; i < str.size(); i++)
-        {
-            if (colon_pos < 0 and str[i] == ':')
-            {
-                colon_pos = i;
-            }
-            if (dot_pos < 0 and str[i] == '.')
-            {
-                if (colon_pos < 0)
-                {
-                    info.valid = false;
-                    break;
-                }
-                dot_pos = i;
-                break;
-            }
-        }
+    string& out_;
+    size_t base_;
+    bool finished_ = false;
+};
 
-        if ((dot_pos != -1 and colon_pos == -1) or (dot_pos == -1 and colon_pos != -1))
-        {
-            info.valid = false;
-        }
+/**
+ * Strings kept per thread so that their capacity is reused by FormatPooled
+ */
+class BufferPool
+{
+public:
+    static BufferPool& Local()
+    {
+        thread_local BufferPool pool;
+        return pool;
+    }
 
-        // if the number before colon is not a number
-        if (colon_pos != -1)
-        {
-            auto parse_result = ParseInteger(str.substr(0, colon_pos), info.arg_index);
-            if (parse_result)
-            {
-                info.is_named_index = parse_result == 1;
-            }
-            else
-            {
-                info.valid = false;
-            }
-        }
-        else
+    string Acquire()
+    {
+        if (buffers_.empty())
         {
-            auto parse_result = ParseInteger(str.substr(0, str.size()), info.arg_index);
-            if (parse_result)
-            {
-                info.is_named_index = parse_result == 1;
-            }
-            else
-            {
-                info.valid = false;
-            }
+            return string();
         }
+        string buffer = std::move(buffers_.back());
+        buffers_.pop_back();
+        buffer.clear();
+        return buffer;
+    }
 
-        // ':' and '.' both exist, we may need to do format
-        if (dot_pos != -1 and colon_pos != -1)
+    void Release(string&& buffer)
+    {
+        // very large buffers are not kept, so that one huge message does not pin its memory
+        if (buffers_.size() < kMaxBuffers and buffer.capacity() <= kMaxCapacity)
         {
-            // if there is char between colon_pos and dot_pos, then it is invalid
-            if (dot_pos != colon_pos + 1)
-            {
-                info.valid = false;
-            }
-            if (str[str.size() - 1] != 'f')
-            {
-                info.valid = false;
-            }
-            auto begin = dot_pos + 1;
-            if (ParseInteger(str.substr(begin, str.size() - begin - 1), info.fraction_num))
-            {
-                info.should_format = true;
-            }
+            buffers_.emplace_back(std::move(buffer));
         }
+    }
 
-        if (not info.valid)
-        {
-            throw "Invalid format of target string";
-        }
+private:
+    static constexpr size_t kMaxBuffers = 16;
+    static constexpr size_t kMaxCapacity = 64 * 1024;
 
-        return info;
-    }
+    vector<string> buffers_;
 };
 
 /**
- * Format function
+ * A string from BufferPool::Local(), given back to the pool of the destroying thread
  */
-template<typename... Args>
-string Format(const string& s, Args&& ...args)
-{
-    std::stringstream sbuf;
-    vector<ArgData> args_data(sizeof...(Args));
-    int arg_index = 0;
-    Unpack(args_data, arg_index, std::forward<Args>(args)...);
-
-    // extract all {***} string structure from s and save it info format_info_vec
-    vector<Parser::FormatInfo> format_info_vec;
-    int next_begin_index = 0;
-    while (true)
-    {
-        auto result = Parser::GetNextBrackets(s, next_begin_index);
-        if (result.second < s.size())
-        {
-            next_begin_index = result.second + 1;
-            auto sub_str = s.substr(result.first + 1, result.second - result.first - 1);
-            auto parse_info = Parser::ParseFormatString(sub_str, arg_index);
-            parse_info.begin = result.first;
-            parse_info.end = result.second;
-            if (parse_info.valid)
-            {
-                format_info_vec.emplace_back(parse_info);
-                if (not parse_info.is_named_index)
-                {
-                    arg_index++;
-                }
-            }
-        }
-        else
+class PooledString
+{
+public:
+    explicit PooledString(string&& str) : str_(std::move(str))
+    {
+    }
+
+    PooledString(PooledString&& other) noexcept : str_(std::move(other.str_)), owned_(other.owned_)
+    {
+        other.owned_ = false;
+    }
+
+    PooledString& operator=(PooledString&& other) noexcept
+    {
+        if (this != &other)
         {
-            break;
+            GiveBack();
+            str_ = std::move(other.str_);
+            owned_ = other.owned_;
+            other.owned_ = false;
         }
+        return *this;
     }
 
-    // format the s
-    int begin = 0;
-    for (auto& format_info:format_info_vec)
+    ~PooledString()
+    {
+        GiveBack();
+    }
+
+    const string& Str() const
+    {
+        return str_;
+    }
+
+    operator std::string_view() const
+    {
+        return str_;
+    }
+
+    /**
+     * Take the string out, it will not go back to the pool
+     */
+    string Release()
+    {
+        owned_ = false;
+        return std::move(str_);
+    }
+
+private:
+    void GiveBack()
     {
-        int end = format_info.begin - 1;
-        sbuf << s.substr(begin, end - begin + 1);
-        if (format_info.arg_index < args_data.size())
+        // a moved-from string keeps its small inline capacity, so ownership is tracked by owned_ instead
+        if (owned_)
         {
-            auto& arg = args_data[format_info.arg_index];
-            if (arg.data_type == DataType::kBool)
-            {
-                sbuf << (arg.data.bool_data ? "true" : "false");
-            }
-            else if (arg.data_type == DataType::kInt)
-            {
-                sbuf << arg.data.int_data;
+            owned_ = false;
+            BufferPool::Local().Release(std::move(str_));
+        }
+    }
+
+    string str_;
+    bool owned_ = true;
+};
+
+/**
+ * Writer into an output iterator, bytes are staged in a small inline buffer
+ */
+template<typename OutputIt>
+class IteratorWriter : public Writer
+{
+public:
+    explicit IteratorWriter(OutputIt out) : Writer(buffer_, sizeof(buffer_)), out_(out)
+    {
+    }
+
+    OutputIt Flush()
+    {
+        out_ = std::copy(data_, data_ + size_, out_);
+        flushed_ += size_;
+        size_ = 0;
+        return out_;
+    }
+
+protected:
+    void Grow(size_t min_capacity) override
+    {
+        Flush();
+    }
+
+private:
+    OutputIt out_;
+    char buffer_[256];
+};
+
+/**
+ * Writer with a fixed buffer of chunk_size bytes, each full chunk is handed to sink,
+ * so the memory used stays the same however long the output is. Call Flush() for the last chunk
+ */
+class ChunkWriter : public Writer
+{
+public:
+    using Sink = std::function<void(std::string_view)>;
+
+    static constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+    explicit ChunkWriter(Sink sink, size_t chunk_size = kDefaultChunkSize)
+        : Writer(nullptr, 0), buffer_(new char[std::max<size_t>(chunk_size, 1)]), sink_(std::move(sink))
+    {
+        data_ = buffer_.get();
+        capacity_ = std::max<size_t>(chunk_size, 1);
+    }
+
+    void Flush()
+    {
+        if (size_ > 0)
+        {
+            sink_(std::string_view(data_, size_));
+            flushed_ += size_;
+            size_ = 0;
+        }
+    }
+
+protected:
+    void Grow(size_t min_capacity) override
+    {
+        Flush();
+    }
+
+private:
+    std::unique_ptr<char[]> buffer_;
+    Sink sink_;
+};
+
+/**
+ * Check whether a class have member function
+ * string ToString();
+ */
+template<typename T>
+struct HasToString
+{
+    typedef char Yes;
+    struct No
+    {
+        char x[2];
+    };
+
+    template<typename U, string (U::*)() = &U::ToString>
+    static Yes Check(U*);
+
+    static No Check(...);
+
+    enum
+    {
+        value = sizeof(Check(static_cast<T*>(nullptr))) == sizeof(Yes)
+    };
+};
+
+#if defined(__SSE2__) and (defined(__GNUC__) or defined(__clang__))
+#define MY_FORMAT_SIMD_SCAN 1
+#endif
+
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define MY_FORMAT_IS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#endif
+#endif
+
+#ifndef MY_FORMAT_IS_CONSTANT_EVALUATED
+#define MY_FORMAT_IS_CONSTANT_EVALUATED() true
+#endif
+
+#if defined(MY_FORMAT_SIMD_SCAN)
+/**
+ * Find the first '{' or '}' in [p, end), 16 bytes per step
+ */
+inline const char* FindBraceSse2(const char* p, const char* end)
+{
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, open), _mm_cmpeq_epi8(chunk, close)));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    for (; p < end; p++)
+    {
+        if (*p == '{' or *p == '}')
+        {
+            return p;
+        }
+    }
+    return end;
+}
+
+/**
+ * Find the first '{' or '}' in [p, end), 32 bytes per step
+ */
+__attribute__((target("avx2"))) inline const char* FindBraceAvx2(const char* p, const char* end)
+{
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, open), _mm256_cmpeq_epi8(chunk, close))));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return FindBraceSse2(p, end);
+}
+#endif
+
+/**
+ * Find the first '{' or '}' in [p, end), or end if there is none.
+ * AVX2 is used when the CPU has it, SSE2 otherwise
+ */
+inline const char* FindBrace(const char* p, const char* end)
+{
+#if defined(MY_FORMAT_SIMD_SCAN)
+    static const auto find_brace = __builtin_cpu_supports("avx2") ? &FindBraceAvx2 : &FindBraceSse2;
+    return find_brace(p, end);
+#else
+    for (; p < end; p++)
+    {
+        if (*p == '{' or *p == '}')
+        {
+            return p;
+        }
+    }
+    return end;
+#endif
+}
+
+/**
+ * This class is used for decode "{0} {} {1:.2f}"
+ * All members are constexpr so that literal templates can be parsed at compile time
+ */
+class Parser
+{
+public:
+    static constexpr pair<int, int> GetNextBrackets(std::string_view s, int begin_index)
+    {
+        bool begin_found = false;
+        int begin = s.size();
+        int end = s.size();
+        if (not MY_FORMAT_IS_CONSTANT_EVALUATED())
+        {
+            // at run time, jump from brace to brace with the vectorized scanner
+            const char* s_end = s.data() + s.size();
+            for (const char* p = FindBrace(s.data() + begin_index, s_end); p != s_end; p = FindBrace(p + 1, s_end))
+            {
+                if (*p == '{')
+                {
+                    begin = p - s.data();
+                    begin_found = true;
+                }
+                else if (begin_found)
+                {
+                    end = p - s.data();
+                    break;
+                }
+            }
+            return {begin, end};
+        }
+        for (int i = begin_index; i < static_cast<int>(s.size()); i++)
+        {
+            if (s[i] == '{')
+            {
+                begin = i;
+                begin_found = true;
+            }
+            if (begin_found and s[i] == '}')
+            {
+                end = i;
+                break;
+            }
+        }
+        return {begin, end};
+    }
+
+    struct FormatInfo
+    {
+        int begin = 0;
+        int end = 0;
+        bool valid = false;
+        bool is_named_index = false;
+        int arg_index = 0;
+        bool should_format = false;
+        int fraction_num = 0;
+        // minimum number of chars, padded with fill according to align ('<', '>' or '^', 0 for default)
+        int width = 0;
+        char align = 0;
+        char fill = ' ';
+        // base of an integer: 'x' or 'X' for hex, 'o' for octal, 'b' for binary, 0 for decimal
+        char type = 0;
+    };
+
+    static constexpr bool IsAlign(char c)
+    {
+        return c == '<' or c == '>' or c == '^';
+    }
+
+    static constexpr bool IsIntegerType(char c)
+    {
+        return c == 'x' or c == 'X' or c == 'o' or c == 'b';
+    }
+
+    static constexpr size_t CountDigits(std::string_view s, size_t begin)
+    {
+        size_t end = begin;
+        while (end < s.size() and s[end] >= '0' and s[end] <= '9')
+        {
+            end++;
+        }
+        return end - begin;
+    }
+
+    // 0-for fail 1-success 2-empty
+    static constexpr int ParseInteger(std::string_view s, int& result)
+    {
+        if (s.empty())
+        {
+            return 2;
+        }
+        int value = 0;
+        for (char c : s)
+        {
+            if (c < '0' or c > '9' or value > (INT_MAX - (c - '0')) / 10)
+            {
+                return 0;
+            }
+            value = value * 10 + (c - '0');
+        }
+        result = value;
+        return 1;
+    }
+
+    /**
+     * Parse the inside of {***}: [index][:[[fill]align][width][.fraction_numf]]
+     */
+    static constexpr FormatInfo ParseFormatString(std::string_view str, int default_arg_index)
+    {
+        FormatInfo info;
+        info.valid = true;
+        info.arg_index = default_arg_index;
+        info.should_format = false;
+
+        size_t colon_pos = str.find(':');
+
+        // if the number before colon is not a number
+        auto parse_result = ParseInteger(str.substr(0, colon_pos), info.arg_index);
+        if (parse_result)
+        {
+            info.is_named_index = parse_result == 1;
+        }
+        else
+        {
+            info.valid = false;
+        }
+
+        if (colon_pos != std::string_view::npos)
+        {
+            auto spec = str.substr(colon_pos + 1);
+            size_t pos = 0;
+            if (spec.size() >= 2 and IsAlign(spec[1]))
+            {
+                info.fill = spec[0];
+                info.align = spec[1];
+                pos = 2;
+            }
+            else if (not spec.empty() and IsAlign(spec[0]))
+            {
+                info.align = spec[0];
+                pos = 1;
+            }
+
+            size_t width_size = CountDigits(spec, pos);
+            if (width_size != 0 and ParseInteger(spec.substr(pos, width_size), info.width) != 1)
+            {
+                info.valid = false;
+            }
+            pos += width_size;
+
+            // '.' and 'f' both exist, we need to do format
+            if (pos < spec.size() and spec[pos] == '.')
+            {
+                pos++;
+                size_t fraction_size = CountDigits(spec, pos);
+                if (ParseInteger(spec.substr(pos, fraction_size), info.fraction_num))
+                {
+                    info.should_format = true;
+                }
+                pos += fraction_size;
+                if (pos < spec.size() and spec[pos] == 'f')
+                {
+                    pos++;
+                }
+                else
+                {
+                    info.valid = false;
+                }
+            }
+            else if (pos < spec.size() and IsIntegerType(spec[pos]))
+            {
+                info.type = spec[pos];
+                pos++;
+            }
+
+            // an empty spec, or chars left after it, is invalid
+            if (spec.empty() or pos != spec.size())
+            {
+                info.valid = false;
+            }
+        }
+
+        if (not info.valid)
+        {
+            throw "Invalid format of target string";
+        }
+
+        return info;
+    }
+
+    /**
+     * Call on_field(FormatInfo) for every {***} in s, in order.
+     * Throws when s is larger than INT_MAX, the offsets in FormatInfo are int
+     */
+    template<typename OnField>
+    static constexpr void ForEachField(std::string_view s, OnField&& on_field)
+    {
+        if (s.size() > static_cast<size_t>(INT_MAX))
+        {
+            throw "Target string larger than 2 GB";
+        }
+        int arg_index = 0;
+        int next_begin_index = 0;
+        while (true)
+        {
+            auto result = GetNextBrackets(s, next_begin_index);
+            if (result.second < static_cast<int>(s.size()))
+            {
+                next_begin_index = result.second + 1;
+                auto sub_str = s.substr(result.first + 1, result.second - result.first - 1);
+                auto parse_info = ParseFormatString(sub_str, arg_index);
+                parse_info.begin = result.first;
+                parse_info.end = result.second;
+                if (parse_info.valid)
+                {
+                    on_field(parse_info);
+                    if (not parse_info.is_named_index)
+                    {
+                        arg_index++;
+                    }
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    static constexpr size_t CountFields(std::string_view s)
+    {
+        size_t count = 0;
+        ForEachField(s, [&count](const FormatInfo&) { count++; });
+        return count;
+    }
+
+    /**
+     * Length of the output when every {***} has a width and no value is wider than its field,
+     * string::npos if some {***} has no width
+     */
+    static constexpr size_t FixedWidthSize(std::string_view s, const FormatInfo* format_infos, size_t format_info_num)
+    {
+        size_t size = s.size();
+        for (size_t i = 0; i < format_info_num; i++)
+        {
+            if (format_infos[i].width == 0)
+            {
+                return string::npos;
+            }
+            size = size - (format_infos[i].end - format_infos[i].begin + 1) + format_infos[i].width;
+        }
+        return size;
+    }
+
+    template<size_t N>
+    static constexpr std::array<FormatInfo, N> ParseFields(std::string_view s)
+    {
+        std::array<FormatInfo, N> infos{};
+        size_t index = 0;
+        ForEachField(s, [&infos, &index](const FormatInfo& info) { infos[index++] = info; });
+        return infos;
+    }
+};
+
+#if defined(MY_FORMAT_STATS)
+/**
+ * Counters of one template, see FormatStats
+ */
+struct TemplateStats
+{
+    uint64_t calls = 0;
+    // bytes appended to the writer, not counted by Print(int fd, ...)
+    uint64_t output_bytes = 0;
+    // nanoseconds spent capturing the arguments and in their ToString()
+    uint64_t decode_ns = 0;
+    // nanoseconds spent finding and parsing the {***}
+    uint64_t parse_ns = 0;
+    // nanoseconds spent rendering, decode and parse excluded
+    uint64_t render_ns = 0;
+
+    uint64_t TotalNs() const
+    {
+        return decode_ns + parse_ns + render_ns;
+    }
+
+    TemplateStats& operator+=(const TemplateStats& other)
+    {
+        calls += other.calls;
+        output_bytes += other.output_bytes;
+        decode_ns += other.decode_ns;
+        parse_ns += other.parse_ns;
+        render_ns += other.render_ns;
+        return *this;
+    }
+
+    TemplateStats& operator-=(const TemplateStats& other)
+    {
+        calls -= other.calls;
+        output_bytes -= other.output_bytes;
+        decode_ns -= other.decode_ns;
+        parse_ns -= other.parse_ns;
+        render_ns -= other.render_ns;
+        return *this;
+    }
+};
+
+/**
+ * Opt-in instrumentation, compiled in with -DMY_FORMAT_STATS and out otherwise.
+ * Each thread counts into its own table, keyed by the address and size of the template, so a render neither
+ * hashes the template text nor takes a lock: the owner only locks its table to add a template, and its counters
+ * are atomics with a single writer that Snapshot() reads. A template rebuilt at a new address gets a new entry,
+ * Snapshot() merges the entries by label and size.
+ * Time spent before a render starts, e.g. capturing its arguments, is charged to the next render of the thread
+ */
+class FormatStats
+{
+public:
+    static uint64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * Counts one render of a template, from construction to destruction
+     */
+    class RenderScope
+    {
+    public:
+        RenderScope(std::string_view template_str, const Writer* writer)
+            : template_str_(template_str), writer_(writer), parent_(Current())
+        {
+            stats_ = Pending();
+            Pending() = TemplateStats();
+            Current() = this;
+            start_size_ = writer_ != nullptr ? writer_->Size() : 0;
+            start_ = Now();
+        }
+
+        RenderScope(const RenderScope&) = delete;
+        RenderScope& operator=(const RenderScope&) = delete;
+
+        /**
+         * For a render without a writer to measure, e.g. the two passes of VFormat
+         */
+        void AddOutputBytes(size_t size)
+        {
+            stats_.output_bytes += size;
+        }
+
+        ~RenderScope()
+        {
+            uint64_t elapsed = Now() - start_;
+            stats_.calls = 1;
+            stats_.render_ns = elapsed > excluded_ns_ ? elapsed - excluded_ns_ : 0;
+            // writers which flush, e.g. IteratorWriter, may end with less than they started
+            if (writer_ != nullptr and writer_->Size() >= start_size_)
+            {
+                stats_.output_bytes = writer_->Size() - start_size_;
+            }
+            Current() = parent_;
+            Record(template_str_, stats_);
+        }
+
+    private:
+        friend class FormatStats;
+
+        std::string_view template_str_;
+        const Writer* writer_;
+        RenderScope* parent_;
+        TemplateStats stats_;
+        // decode and parse time inside the scope
+        uint64_t excluded_ns_ = 0;
+        size_t start_size_ = 0;
+        uint64_t start_ = 0;
+    };
+
+    /**
+     * Charge ns to counter of the innermost render running on this thread, or of the next one
+     */
+    static void Charge(uint64_t TemplateStats::*counter, uint64_t ns)
+    {
+        RenderScope* current = Current();
+        if (current != nullptr)
+        {
+            current->stats_.*counter += ns;
+            current->excluded_ns_ += ns;
+        }
+        else
+        {
+            Pending().*counter += ns;
+        }
+    }
+
+    /**
+     * Add stats to the counters of template_str in the table of this thread
+     */
+    static void Record(std::string_view template_str, const TemplateStats& stats)
+    {
+        ThreadTable& table = Local();
+        Key key{template_str.data(), template_str.size()};
+        auto it = table.index.find(key);
+        if (it == table.index.end())
+        {
+            std::lock_guard<std::mutex> lock(table.mutex);
+            Entry& entry = table.entries.emplace_back(template_str.substr(0, kLabelSize), template_str.size());
+            it = table.index.emplace(key, &entry).first;
+        }
+        it->second->counters.Add(stats);
+    }
+
+    /**
+     * Forget the time charged to the next render, e.g. after FormattedSize() which renders nothing
+     */
+    static void DiscardPending()
+    {
+        Pending() = TemplateStats();
+    }
+
+    /**
+     * The counters of every thread summed per template, the most expensive first
+     */
+    static vector<pair<string, TemplateStats>> Snapshot()
+    {
+        std::map<pair<string, size_t>, TemplateStats> sums;
+        for (auto& table : Tables())
+        {
+            std::lock_guard<std::mutex> lock(table->mutex);
+            for (auto& entry : table->entries)
+            {
+                TemplateStats stats = entry.counters.Load();
+                stats -= entry.baseline;
+                sums[{entry.label, entry.size}] += stats;
+            }
+        }
+
+        vector<pair<string, TemplateStats>> snapshot;
+        snapshot.reserve(sums.size());
+        for (auto& entry : sums)
+        {
+            snapshot.emplace_back(entry.first.first, entry.second);
+        }
+        std::sort(snapshot.begin(), snapshot.end(), [](const auto& left, const auto& right) {
+            return left.second.TotalNs() > right.second.TotalNs();
+        });
+        return snapshot;
+    }
+
+    /**
+     * Write the top templates of Snapshot() to file as a table
+     */
+    static void Dump(FILE* file = stderr, size_t top = 20)
+    {
+        auto snapshot = Snapshot();
+        std::fprintf(file, "%12s %14s %12s %12s %12s %10s  %s\n",
+                     "calls", "bytes", "decode_us", "parse_us", "render_us", "ns/call", "template");
+        for (size_t i = 0; i < snapshot.size() and i < top; i++)
+        {
+            auto& stats = snapshot[i].second;
+            string template_str = snapshot[i].first.substr(0, 60);
+            std::replace(template_str.begin(), template_str.end(), '\n', ' ');
+            std::fprintf(file, "%12llu %14llu %12llu %12llu %12llu %10llu  %s\n",
+                         static_cast<unsigned long long>(stats.calls),
+                         static_cast<unsigned long long>(stats.output_bytes),
+                         static_cast<unsigned long long>(stats.decode_ns / 1000),
+                         static_cast<unsigned long long>(stats.parse_ns / 1000),
+                         static_cast<unsigned long long>(stats.render_ns / 1000),
+                         static_cast<unsigned long long>(stats.calls > 0 ? stats.TotalNs() / stats.calls : 0),
+                         template_str.c_str());
+        }
+    }
+
+    /**
+     * Zero the counters of every thread, by remembering where they are since only their thread writes them
+     */
+    static void Reset()
+    {
+        for (auto& table : Tables())
+        {
+            std::lock_guard<std::mutex> lock(table->mutex);
+            for (auto& entry : table->entries)
+            {
+                entry.baseline = entry.counters.Load();
+            }
+        }
+    }
+
+private:
+    // chars of a template kept for Dump(), a multi-megabyte template is not copied
+    static constexpr size_t kLabelSize = 60;
+
+    /**
+     * TemplateStats written by one thread and read by any, relaxed loads and stores are enough
+     */
+    struct AtomicStats
+    {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> output_bytes{0};
+        std::atomic<uint64_t> decode_ns{0};
+        std::atomic<uint64_t> parse_ns{0};
+        std::atomic<uint64_t> render_ns{0};
+
+        static void Add(std::atomic<uint64_t>& counter, uint64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        void Add(const TemplateStats& stats)
+        {
+            Add(calls, stats.calls);
+            Add(output_bytes, stats.output_bytes);
+            Add(decode_ns, stats.decode_ns);
+            Add(parse_ns, stats.parse_ns);
+            Add(render_ns, stats.render_ns);
+        }
+
+        TemplateStats Load() const
+        {
+            TemplateStats stats;
+            stats.calls = calls.load(std::memory_order_relaxed);
+            stats.output_bytes = output_bytes.load(std::memory_order_relaxed);
+            stats.decode_ns = decode_ns.load(std::memory_order_relaxed);
+            stats.parse_ns = parse_ns.load(std::memory_order_relaxed);
+            stats.render_ns = render_ns.load(std::memory_order_relaxed);
+            return stats;
+        }
+    };
+
+    struct Entry
+    {
+        Entry(std::string_view label, size_t size) : label(label), size(size)
+        {
+        }
+
+        string label;
+        size_t size;
+        AtomicStats counters;
+        // the counters at the last Reset(), guarded by the mutex of the table
+        TemplateStats baseline;
+    };
+
+    using Key = pair<const char*, size_t>;
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return std::hash<const char*>()(key.first) ^ (key.second * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    struct ThreadTable
+    {
+        // taken by the owner only to add an entry, and by Snapshot() and Reset()
+        std::mutex mutex;
+        // std::deque never moves its elements, so index and the readers may point into it
+        std::deque<Entry> entries;
+        // only used by the owner
+        std::unordered_map<Key, Entry*, KeyHash> index;
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        // tables outlive their threads so that nothing counted is lost
+        vector<std::shared_ptr<ThreadTable>> tables;
+    };
+
+    static Registry& GetRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    static vector<std::shared_ptr<ThreadTable>> Tables()
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        return registry.tables;
+    }
+
+    static ThreadTable& Local()
+    {
+        thread_local std::shared_ptr<ThreadTable> table = [] {
+            auto new_table = std::make_shared<ThreadTable>();
+            Registry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.tables.push_back(new_table);
+            return new_table;
+        }();
+        return *table;
+    }
+
+    static RenderScope*& Current()
+    {
+        thread_local RenderScope* current = nullptr;
+        return current;
+    }
+
+    static TemplateStats& Pending()
+    {
+        thread_local TemplateStats pending;
+        return pending;
+    }
+};
+
+/**
+ * Times the rest of the enclosing block into the given TemplateStats counter
+ */
+class FormatStatsTimer
+{
+public:
+    explicit FormatStatsTimer(uint64_t TemplateStats::*counter) : counter_(counter), start_(FormatStats::Now())
+    {
+    }
+
+    ~FormatStatsTimer()
+    {
+        FormatStats::Charge(counter_, FormatStats::Now() - start_);
+    }
+
+private:
+    uint64_t TemplateStats::*counter_;
+    uint64_t start_;
+};
+
+#define MY_FORMAT_STATS_TIMER(counter) FormatStatsTimer my_format_stats_timer(&TemplateStats::counter)
+#define MY_FORMAT_STATS_RENDER(template_str, writer) \
+    FormatStats::RenderScope my_format_stats_scope(template_str, writer)
+#define MY_FORMAT_STATS_DISCARD_PENDING() FormatStats::DiscardPending()
+#else
+#define MY_FORMAT_STATS_TIMER(counter)
+#define MY_FORMAT_STATS_RENDER(template_str, writer)
+#define MY_FORMAT_STATS_DISCARD_PENDING()
+#endif
+
+enum class DataType
+{
+    kBool,
+    kChar,
+    kInt,
+    kUInt,
+    kInt64,
+    kUInt64,
+    kFloat,
+    kDouble,
+    kString,
+    kCustom,
+    kCustomToString,
+    kBytes
+};
+
+/**
+ * One captured argument. It is trivially copyable, strings and custom objects are referenced, not copied,
+ * so they must outlive the rendering
+ */
+struct ArgData
+{
+    struct StringData
+    {
+        const char* data;
+        size_t size;
+    };
+
+    struct CustomData
+    {
+        const void* object;
+        void (*format)(Writer& writer, const void* object, const Parser::FormatInfo& format_info);
+    };
+
+    struct ToStringData
+    {
+        const void* object;
+        string (*to_string)(const void* object);
+    };
+
+    union Data
+    {
+        bool bool_data;
+        char char_data;
+        int int_data;
+        unsigned int uint_data;
+        int64_t int64_data;
+        uint64_t uint64_data;
+        float float_data;
+        double double_data;
+        // kString and kBytes
+        StringData str_data;
+        CustomData custom_data;
+        ToStringData to_string_data;
+    };
+    Data data;
+    DataType data_type;
+};
+
+static_assert(std::is_trivially_copyable<ArgData>::value, "ArgData is copied around as plain bytes");
+
+/**
+ * View of the arguments captured for one call
+ */
+struct ArgList
+{
+    const ArgData* data = nullptr;
+    size_t size = 0;
+};
+
+/**
+ * Argument rendered as the hex of its bytes, two digits per byte, {:X} for upper case.
+ * The bytes are referenced, not copied
+ */
+struct ByteSpan
+{
+    ByteSpan(const void* bytes, size_t byte_num) : data(static_cast<const char*>(bytes)), size(byte_num)
+    {
+    }
+
+    /**
+     * Any contiguous container of bytes, e.g. std::vector<uint8_t>, std::array<char, N> or std::string
+     */
+    template<typename Container,
+             typename = std::enable_if_t<sizeof(*std::data(std::declval<const Container&>())) == 1>>
+    explicit ByteSpan(const Container& container) : data(reinterpret_cast<const char*>(std::data(container))),
+                                                    size(std::size(container))
+    {
+    }
+
+    const char* data;
+    size_t size;
+};
+
+/**
+ * Check whether a class have member function
+ * void FormatTo(Writer& writer, const Parser::FormatInfo& format_info) const;
+ * which appends the object straight into the output, format_info holds the spec of the {***}
+ */
+template<typename T>
+struct HasFormatTo
+{
+    typedef char Yes;
+    struct No
+    {
+        char x[2];
+    };
+
+    template<typename U, void (U::*)(Writer&, const Parser::FormatInfo&) const = &U::FormatTo>
+    static Yes Check(U*);
+
+    static No Check(...);
+
+    enum
+    {
+        value = sizeof(Check(static_cast<T*>(nullptr))) == sizeof(Yes)
+    };
+};
+
+/**
+ * Write a custom object through its FormatTo()
+ */
+template<typename T>
+void FormatByFormatTo(Writer& writer, const void* object, const Parser::FormatInfo& format_info)
+{
+    static_cast<const T*>(object)->FormatTo(writer, format_info);
+}
+
+/**
+ * Decode a custom object through its ToString()
+ */
+template<typename T>
+string DecodeByToString(const void* object)
+{
+    // ToString() is not const, the object is only referenced through a const pointer for storage
+    return const_cast<T*>(static_cast<const T*>(object))->ToString();
+}
+
+/**
+ * Check whether std::size() can be called on a range
+ */
+template<typename T, typename = void>
+struct HasSize : std::false_type
+{
+};
+
+template<typename T>
+struct HasSize<T, std::void_t<decltype(std::size(std::declval<const T&>()))>> : std::true_type
+{
+};
+
+/**
+ * Check whether the elements of a range are contiguous in memory, i.e. std::data() gives a pointer
+ */
+template<typename T, typename = void>
+struct HasData : std::false_type
+{
+};
+
+template<typename T>
+struct HasData<T, std::void_t<decltype(std::data(std::declval<const T&>()))>>
+    : std::is_pointer<decltype(std::data(std::declval<const T&>()))>
+{
+};
+
+/**
+ * Check whether a type can be iterated by a range-based for, e.g. std::vector, std::list or std::map
+ */
+template<typename T, typename = void>
+struct IsRange : std::false_type
+{
+};
+
+template<typename T>
+struct IsRange<T, std::void_t<decltype(std::begin(std::declval<const T&>())),
+                              decltype(std::end(std::declval<const T&>()))>> : std::true_type
+{
+};
+
+/**
+ * The elements of range separated by separator, without brackets, see Join()
+ */
+template<typename Range>
+struct JoinView
+{
+    const Range* range;
+    std::string_view separator;
+};
+
+/**
+ * Render the elements of range separated by separator, the spec of the {***} applies to every element,
+ * e.g. Format("{:.2f}", Join(points, ";")). range is referenced, not copied
+ */
+template<typename Range>
+JoinView<Range> Join(const Range& range, std::string_view separator)
+{
+    return JoinView<Range>{&range, separator};
+}
+
+template<typename T>
+struct IsJoinView : std::false_type
+{
+};
+
+template<typename Range>
+struct IsJoinView<JoinView<Range>> : std::true_type
+{
+};
+
+/**
+ * Write a range as [a, b] or, when its elements are pairs like in a std::map, {k: v}.
+ * Defined with the renderers below
+ */
+template<typename Range>
+void FormatRange(Writer& writer, const void* object, const Parser::FormatInfo& format_info);
+
+/**
+ * Write a JoinView, defined with the renderers below
+ */
+template<typename View>
+void FormatJoin(Writer& writer, const void* object, const Parser::FormatInfo& format_info);
+
+/**
+ * Function for terminate extract argument package
+ */
+inline void Unpack(ArgData* args_data, int arg_index)
+{
+}
+
+/**
+ * Function for extract argument package
+ */
+template<typename FirstArg, typename... TailArgs>
+void Unpack(ArgData* args_data, int arg_index, FirstArg&& first_arg, TailArgs&& ...tail_args)
+{
+    using Type = std::remove_const_t<std::remove_reference_t<FirstArg>>;
+    // id constexpr is a kind of static if in compile time
+    if constexpr (std::is_same<Type, bool>::value)
+    {
+        args_data[arg_index].data.bool_data = first_arg;
+        args_data[arg_index].data_type = DataType::kBool;
+    }
+    else if constexpr (std::is_same<Type, char>::value)
+    {
+        args_data[arg_index].data.char_data = first_arg;
+        args_data[arg_index].data_type = DataType::kChar;
+    }
+    else if constexpr (std::is_integral<Type>::value)
+    {
+        // integers narrower than int are widened, the rest keep their width and signedness
+        if constexpr (std::is_signed<Type>::value and sizeof(Type) <= sizeof(int))
+        {
+            args_data[arg_index].data.int_data = first_arg;
+            args_data[arg_index].data_type = DataType::kInt;
+        }
+        else if constexpr (std::is_signed<Type>::value)
+        {
+            args_data[arg_index].data.int64_data = first_arg;
+            args_data[arg_index].data_type = DataType::kInt64;
+        }
+        else if constexpr (sizeof(Type) <= sizeof(unsigned int))
+        {
+            args_data[arg_index].data.uint_data = first_arg;
+            args_data[arg_index].data_type = DataType::kUInt;
+        }
+        else
+        {
+            args_data[arg_index].data.uint64_data = first_arg;
+            args_data[arg_index].data_type = DataType::kUInt64;
+        }
+    }
+    else if constexpr (std::is_same<Type, float>::value)
+    {
+        args_data[arg_index].data.float_data = first_arg;
+        args_data[arg_index].data_type = DataType::kFloat;
+    }
+    else if constexpr (std::is_same<Type, double>::value)
+    {
+        args_data[arg_index].data.double_data = first_arg;
+        args_data[arg_index].data_type = DataType::kDouble;
+    }
+    else if constexpr (std::is_same<std::decay_t<Type>, char const*>::value or
+                       std::is_same<std::decay_t<Type>, char*>::value)
+    {
+        const char* str = first_arg;
+        if (str == nullptr)
+        {
+            str = "";
+        }
+        args_data[arg_index].data.str_data = {str, std::strlen(str)};
+        args_data[arg_index].data_type = DataType::kString;
+    }
+    else if constexpr (std::is_same<Type, std::string>::value or std::is_same<Type, std::string_view>::value)
+    {
+        args_data[arg_index].data.str_data = {first_arg.data(), first_arg.size()};
+        args_data[arg_index].data_type = DataType::kString;
+    }
+    else if constexpr (std::is_same<Type, ByteSpan>::value)
+    {
+        args_data[arg_index].data.str_data = {first_arg.data, first_arg.size};
+        args_data[arg_index].data_type = DataType::kBytes;
+    }
+    else if constexpr (IsJoinView<Type>::value)
+    {
+        args_data[arg_index].data.custom_data = {&first_arg, &FormatJoin<Type>};
+        args_data[arg_index].data_type = DataType::kCustom;
+    }
+    else if constexpr (std::is_class<Type>::value)
+    {
+        if constexpr (HasFormatTo<Type>::value)
+        {
+            args_data[arg_index].data.custom_data = {&first_arg, &FormatByFormatTo<Type>};
+            args_data[arg_index].data_type = DataType::kCustom;
+        }
+        else if constexpr (HasToString<Type>::value)
+        {
+            // ToString() is only called if a {***} renders this argument, see ArgRenderer
+            args_data[arg_index].data.to_string_data = {&first_arg, &DecodeByToString<Type>};
+            args_data[arg_index].data_type = DataType::kCustomToString;
+        }
+        else if constexpr (IsRange<Type>::value)
+        {
+            args_data[arg_index].data.custom_data = {&first_arg, &FormatRange<Type>};
+            args_data[arg_index].data_type = DataType::kCustom;
+        }
+        else
+        {
+            args_data[arg_index].data.str_data = {"?", 1};
+            args_data[arg_index].data_type = DataType::kString;
+        }
+    }
+    arg_index++;
+    Unpack(args_data, arg_index, std::forward<TailArgs>(tail_args)...);
+}
+
+/**
+ * Capture the arguments of one call on the stack, nothing is allocated
+ */
+template<typename... Args>
+std::array<ArgData, sizeof...(Args)> CaptureArgs(Args&& ...args)
+{
+    MY_FORMAT_STATS_TIMER(decode_ns);
+    std::array<ArgData, sizeof...(Args)> args_data;
+    Unpack(args_data.data(), 0, std::forward<Args>(args)...);
+    return args_data;
+}
+
+/**
+ * Base class of the string types generated by FORMAT_STRING
+ */
+struct CompileTimeFormatString
+{
+};
+
+/**
+ * Wrap a string literal so that it is parsed at compile time, e.g.
+ * Format(FORMAT_STRING("{0} {1:.2f}"), 1, 2.0);
+ * A malformed template fails the build instead of throwing at run time.
+ */
+#define FORMAT_STRING(s) \
+    [] { \
+        struct Str : CompileTimeFormatString \
+        { \
+            static constexpr std::string_view Get() { return s; } \
+        }; \
+        return Str{}; \
+    }()
+
+/**
+ * The literal segments and {***} records of a FORMAT_STRING, computed at compile time.
+ * Literal segment i is [infos[i - 1].end + 1, infos[i].begin) of str
+ */
+template<typename S>
+struct StaticFormat
+{
+    static constexpr std::string_view str = S::Get();
+    static constexpr size_t size = Parser::CountFields(str);
+    static constexpr std::array<Parser::FormatInfo, size> infos = Parser::ParseFields<size>(str);
+    static constexpr size_t fixed_width_size = Parser::FixedWidthSize(str, infos.data(), size);
+};
+
+/**
+ * A template that is only known at run time, parsed once so that it can be rendered many times.
+ * Literal segment i is [FormatInfos()[i - 1].end + 1, FormatInfos()[i].begin) of Str()
+ */
+class CompiledFormat
+{
+public:
+    explicit CompiledFormat(string s) : str_(std::move(s))
+    {
+#if defined(MY_FORMAT_STATS)
+        // parsed once, so charged to this template rather than to a render
+        uint64_t start = FormatStats::Now();
+#endif
+        Parser::ForEachField(str_, [this](const Parser::FormatInfo& info) { format_infos_.emplace_back(info); });
+#if defined(MY_FORMAT_STATS)
+        TemplateStats stats;
+        stats.parse_ns = FormatStats::Now() - start;
+        FormatStats::Record(str_, stats);
+#endif
+    }
+
+    const string& Str() const
+    {
+        return str_;
+    }
+
+    const vector<Parser::FormatInfo>& FormatInfos() const
+    {
+        return format_infos_;
+    }
+
+    /**
+     * See Parser::FixedWidthSize
+     */
+    size_t FixedWidthSize() const
+    {
+        return Parser::FixedWidthSize(str_, format_infos_.data(), format_infos_.size());
+    }
+
+    std::string_view Literal(size_t index) const
+    {
+        int begin = index == 0 ? 0 : format_infos_[index - 1].end + 1;
+        int end = index < format_infos_.size() ? format_infos_[index].begin : str_.size();
+        return std::string_view(str_).substr(begin, end - begin);
+    }
+
+private:
+    string str_;
+    vector<Parser::FormatInfo> format_infos_;
+};
+
+/**
+ * Bounded, thread-safe cache of CompiledFormat keyed by the template.
+ * When full, the least recently used template is dropped.
+ */
+class FormatCache
+{
+public:
+    explicit FormatCache(size_t capacity = 1024) : capacity_(std::max<size_t>(capacity, 1))
+    {
+    }
+
+    std::shared_ptr<const CompiledFormat> Get(std::string_view s)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(s);
+        if (it != index_.end())
+        {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return *it->second;
+        }
+        if (lru_.size() >= capacity_)
+        {
+            index_.erase(lru_.back()->Str());
+            lru_.pop_back();
+        }
+        lru_.emplace_front(std::make_shared<const CompiledFormat>(string(s)));
+        index_.emplace(lru_.front()->Str(), lru_.begin());
+        return lru_.front();
+    }
+
+    size_t Size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lru_.size();
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_.clear();
+        lru_.clear();
+    }
+
+    static FormatCache& Global()
+    {
+        static FormatCache cache;
+        return cache;
+    }
+
+    /**
+     * Cache of the calling thread, its lock and its reference counts are never touched by another thread
+     */
+    static FormatCache& Local()
+    {
+        thread_local FormatCache cache;
+        return cache;
+    }
+
+private:
+    using List = std::list<std::shared_ptr<const CompiledFormat>>;
+
+    size_t capacity_;
+    mutable std::mutex mutex_;
+    List lru_;
+    // keys point into the CompiledFormat owned by lru_
+    std::unordered_map<std::string_view, List::iterator> index_;
+};
+
+/**
+ * "00" "01" ... "99", used to convert integers two digits at a time
+ */
+inline constexpr char kDigitPairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/**
+ * Write the decimal digits of value so that they end right before end, and return the first digit
+ */
+template<typename UInt>
+char* FormatDecimal(char* end, UInt value)
+{
+    while (value >= 100)
+    {
+        auto index = static_cast<size_t>(value % 100) * 2;
+        value /= 100;
+        end -= 2;
+        std::memcpy(end, kDigitPairs + index, 2);
+    }
+    if (value < 10)
+    {
+        *--end = static_cast<char>('0' + value);
+        return end;
+    }
+    end -= 2;
+    std::memcpy(end, kDigitPairs + static_cast<size_t>(value) * 2, 2);
+    return end;
+}
+
+/**
+ * Write value backwards into the chars before end, in the base given by a FormatInfo::type
+ * other than 0, and return the first char
+ */
+template<typename UInt>
+char* FormatInBase(char* end, UInt value, char type)
+{
+    const char* digits = type == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+    int shift = type == 'b' ? 1 : (type == 'o' ? 3 : 4);
+    UInt mask = (UInt(1) << shift) - 1;
+    do
+    {
+        *--end = digits[value & mask];
+        value >>= shift;
+    } while (value != 0);
+    return end;
+}
+
+// room for any integer in any base: 64 binary digits and the sign
+constexpr size_t kMaxIntegerSize = 72;
+
+/**
+ * Write an integer backwards into the chars before end, in decimal or in the base of type,
+ * and return the first char. 32 bit values never go through 64 bit division.
+ * A negative value in another base is written as '-' and its magnitude
+ */
+template<typename Int>
+char* FormatInteger(char* end, Int value, char type)
+{
+    using UInt = std::conditional_t<(sizeof(Int) > sizeof(uint32_t)), uint64_t, uint32_t>;
+    auto abs_value = static_cast<UInt>(value);
+    bool negative = false;
+    if constexpr (std::is_signed<Int>::value)
+    {
+        if (value < 0)
+        {
+            negative = true;
+            abs_value = 0 - abs_value;
+        }
+    }
+    char* begin = type == 0 ? FormatDecimal(end, abs_value) : FormatInBase(end, abs_value, type);
+    if (negative)
+    {
+        *--begin = '-';
+    }
+    return begin;
+}
+
+/**
+ * Number of chars FormatInteger writes, counted without converting
+ */
+template<typename Int>
+size_t IntegerSize(Int value, char type)
+{
+    using UInt = std::conditional_t<(sizeof(Int) > sizeof(uint32_t)), uint64_t, uint32_t>;
+    auto abs_value = static_cast<UInt>(value);
+    size_t size = 0;
+    if constexpr (std::is_signed<Int>::value)
+    {
+        if (value < 0)
+        {
+            size = 1;
+            abs_value = 0 - abs_value;
+        }
+    }
+    if (type == 0)
+    {
+        while (abs_value >= 100)
+        {
+            abs_value /= 100;
+            size += 2;
+        }
+        return size + (abs_value >= 10 ? 2 : 1);
+    }
+    int shift = type == 'b' ? 1 : (type == 'o' ? 3 : 4);
+    do
+    {
+        size++;
+        abs_value >>= shift;
+    } while (abs_value != 0);
+    return size;
+}
+
+/**
+ * Write an integer, see FormatInteger
+ */
+template<typename Int>
+void RenderInteger(Writer& writer, Int value, char type = 0)
+{
+    char buffer[kMaxIntegerSize];
+    char* end = buffer + sizeof(buffer);
+    char* begin = FormatInteger(end, value, type);
+    writer.Append(begin, end - begin);
+}
+
+/**
+ * Write bytes as hex, two digits per byte. With SSE2, 16 bytes are encoded at a time:
+ * the nibbles are split, turned into digits with a compare instead of a table lookup and interleaved
+ */
+inline void RenderHex(Writer& writer, const char* data, size_t size, bool upper_case)
+{
+    const char* digits = upper_case ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buffer[512];
+    while (size > 0)
+    {
+        size_t step = std::min(size, sizeof(buffer) / 2);
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i zero = _mm_set1_epi8('0');
+        // from '0' + 10 to 'a' or 'A'
+        const __m128i letter_offset = _mm_set1_epi8(static_cast<char>((upper_case ? 'A' : 'a') - '0' - 10));
+        for (; i + 16 <= step; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble_mask);
+            __m128i low = _mm_and_si128(bytes, nibble_mask);
+            high = _mm_add_epi8(_mm_add_epi8(high, zero), _mm_and_si128(_mm_cmpgt_epi8(high, nine), letter_offset));
+            low = _mm_add_epi8(_mm_add_epi8(low, zero), _mm_and_si128(_mm_cmpgt_epi8(low, nine), letter_offset));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer + 2 * i), _mm_unpacklo_epi8(high, low));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+        }
+#endif
+        for (; i < step; i++)
+        {
+            auto byte = static_cast<unsigned char>(data[i]);
+            buffer[2 * i] = digits[byte >> 4];
+            buffer[2 * i + 1] = digits[byte & 0x0f];
+        }
+        writer.Append(buffer, step * 2);
+        data += step;
+        size -= step;
+    }
+}
+
+/**
+ * Write a floating point number without any stream state.
+ * With {N:.Mf} the output is fixed and correctly rounded to M digits,
+ * otherwise it is the shortest text that reads back as the same value
+ */
+template<typename T>
+void RenderFloatingPoint(Writer& writer, T value, const Parser::FormatInfo& format_info)
+{
+    char buffer[128];
+#if defined(__cpp_lib_to_chars)
+    auto result = format_info.should_format
+                  ? std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed,
+                                  format_info.fraction_num)
+                  : std::to_chars(buffer, buffer + sizeof(buffer), value);
+    if (result.ec == std::errc())
+    {
+        writer.Append(buffer, result.ptr - buffer);
+        return;
+    }
+    // only fixed output with a huge value or fraction_num gets here
+    string long_buffer(std::numeric_limits<T>::max_exponent10 + format_info.fraction_num + 3, '\0');
+    result = std::to_chars(&long_buffer[0], &long_buffer[0] + long_buffer.size(), value,
+                           std::chars_format::fixed, format_info.fraction_num);
+    writer.Append(long_buffer.data(), result.ptr - long_buffer.data());
+#else
+    int length = 0;
+    if (format_info.should_format)
+    {
+        length = std::snprintf(buffer, sizeof(buffer), "%.*f", format_info.fraction_num, static_cast<double>(value));
+    }
+    else
+    {
+        // increase the precision until the text reads back as the same value
+        for (int precision = 1; precision <= std::numeric_limits<T>::max_digits10; precision++)
+        {
+            length = std::snprintf(buffer, sizeof(buffer), "%.*g", precision, static_cast<double>(value));
+            if (static_cast<T>(std::strtod(buffer, nullptr)) == value or value != value)
+            {
+                break;
+            }
+        }
+    }
+    if (length < static_cast<int>(sizeof(buffer)))
+    {
+        writer.Append(buffer, length);
+        return;
+    }
+    // only fixed output with a huge value or fraction_num gets here
+    string long_buffer(length + 1, '\0');
+    std::snprintf(&long_buffer[0], long_buffer.size(), "%.*f", format_info.fraction_num, static_cast<double>(value));
+    writer.Append(long_buffer.data(), length);
+#endif
+}
+
+/**
+ * Write one argument, as described by format_info
+ */
+inline void RenderArg(Writer& writer, const Parser::FormatInfo& format_info, const ArgData& arg)
+{
+    if (arg.data_type == DataType::kBool)
+    {
+        writer.Append(arg.data.bool_data ? std::string_view("true") : std::string_view("false"));
+    }
+    else if (arg.data_type == DataType::kChar)
+    {
+        writer.Append(arg.data.char_data);
+    }
+    else if (arg.data_type == DataType::kInt)
+    {
+        RenderInteger(writer, arg.data.int_data, format_info.type);
+    }
+    else if (arg.data_type == DataType::kUInt)
+    {
+        RenderInteger(writer, arg.data.uint_data, format_info.type);
+    }
+    else if (arg.data_type == DataType::kInt64)
+    {
+        RenderInteger(writer, arg.data.int64_data, format_info.type);
+    }
+    else if (arg.data_type == DataType::kUInt64)
+    {
+        RenderInteger(writer, arg.data.uint64_data, format_info.type);
+    }
+    else if (arg.data_type == DataType::kFloat)
+    {
+        RenderFloatingPoint(writer, arg.data.float_data, format_info);
+    }
+    else if (arg.data_type == DataType::kDouble)
+    {
+        RenderFloatingPoint(writer, arg.data.double_data, format_info);
+    }
+    else if (arg.data_type == DataType::kString)
+    {
+        writer.Append(arg.data.str_data.data, arg.data.str_data.size);
+    }
+    else if (arg.data_type == DataType::kCustom)
+    {
+        arg.data.custom_data.format(writer, arg.data.custom_data.object, format_info);
+    }
+    else if (arg.data_type == DataType::kBytes)
+    {
+        RenderHex(writer, arg.data.str_data.data, arg.data.str_data.size, format_info.type == 'X');
+    }
+}
+
+/**
+ * Renders the arguments of one call. An argument is only converted when a {***} renders it,
+ * and a ToString() result is kept so that {0} {0} calls ToString() once
+ */
+class ArgRenderer
+{
+public:
+    explicit ArgRenderer(ArgList args) : args_(args)
+    {
+    }
+
+    void Render(Writer& writer, const Parser::FormatInfo& format_info)
+    {
+        if (format_info.arg_index >= static_cast<int>(args_.size))
+        {
+            return;
+        }
+        auto& arg = args_.data[format_info.arg_index];
+        if (format_info.width == 0)
+        {
+            RenderValue(writer, format_info, arg);
+            return;
+        }
+
+        char align = format_info.align;
+        if (align == 0)
+        {
+            // numbers are right aligned by default, everything else left aligned
+            align = arg.data_type >= DataType::kInt and arg.data_type <= DataType::kDouble ? '>' : '<';
+        }
+        bool measured = arg.data_type != DataType::kFloat and arg.data_type != DataType::kDouble and
+                        arg.data_type != DataType::kCustom;
+        if (measured or align == '<')
+        {
+            // the size is known without rendering, or the padding goes after the value: written in place
+            size_t size = measured ? ValueSize(format_info, arg) : 0;
+            size_t padding = format_info.width > static_cast<int>(size) ? format_info.width - size : 0;
+            size_t left_padding = align == '>' ? padding : align == '^' ? padding / 2 : 0;
+            writer.Fill(left_padding, format_info.fill);
+            size_t begin = writer.Appended();
+            RenderValue(writer, format_info, arg);
+            if (not measured)
+            {
+                size = writer.Appended() - begin;
+                padding = format_info.width > static_cast<int>(size) ? format_info.width - size : 0;
+            }
+            writer.Fill(padding - left_padding, format_info.fill);
+            return;
+        }
+
+        // floats and custom objects right of the padding are rendered aside first, to know the padding
+        MemoryWriter field;
+        RenderValue(field, format_info, arg);
+        size_t padding = format_info.width > static_cast<int>(field.Size()) ? format_info.width - field.Size() : 0;
+        size_t left_padding = align == '>' ? padding : padding / 2;
+        writer.Fill(left_padding, format_info.fill);
+        writer.Append(field.Data(), field.Size());
+        writer.Fill(padding - left_padding, format_info.fill);
+    }
+
+    /**
+     * Number of chars Render() writes for format_info. Integers, strings and bytes are measured without
+     * rendering, floats and custom objects are rendered into a writer that only counts
+     */
+    size_t Size(const Parser::FormatInfo& format_info)
+    {
+        if (format_info.arg_index >= static_cast<int>(args_.size))
+        {
+            return 0;
+        }
+        size_t size = ValueSize(format_info, args_.data[format_info.arg_index]);
+        return std::max(size, static_cast<size_t>(format_info.width));
+    }
+
+private:
+    size_t ValueSize(const Parser::FormatInfo& format_info, const ArgData& arg)
+    {
+        switch (arg.data_type)
+        {
+            case DataType::kBool:
+                return arg.data.bool_data ? 4 : 5;
+            case DataType::kChar:
+                return 1;
+            case DataType::kInt:
+                return IntegerSize(arg.data.int_data, format_info.type);
+            case DataType::kUInt:
+                return IntegerSize(arg.data.uint_data, format_info.type);
+            case DataType::kInt64:
+                return IntegerSize(arg.data.int64_data, format_info.type);
+            case DataType::kUInt64:
+                return IntegerSize(arg.data.uint64_data, format_info.type);
+            case DataType::kString:
+                return arg.data.str_data.size;
+            case DataType::kBytes:
+                return arg.data.str_data.size * 2;
+            case DataType::kCustomToString:
+                return Decode(format_info.arg_index, arg).size();
+            default:
+            {
+                // with no room at all every byte is only counted
+                TruncatingWriter counter(nullptr, 0);
+                RenderArg(counter, format_info, arg);
+                return counter.Total();
+            }
+        }
+    }
+
+    void RenderValue(Writer& writer, const Parser::FormatInfo& format_info, const ArgData& arg)
+    {
+        if (arg.data_type == DataType::kCustomToString)
+        {
+            writer.Append(Decode(format_info.arg_index, arg));
+        }
+        else
+        {
+            RenderArg(writer, format_info, arg);
+        }
+    }
+
+    const string& Decode(int arg_index, const ArgData& arg)
+    {
+        for (auto& decoded : decoded_)
+        {
+            if (decoded.first == arg_index)
+            {
+                return decoded.second;
+            }
+        }
+        MY_FORMAT_STATS_TIMER(decode_ns);
+        decoded_.emplace_back(arg_index, arg.data.to_string_data.to_string(arg.data.to_string_data.object));
+        return decoded_.back().second;
+    }
+
+    ArgList args_;
+    // arguments decoded by ToString() so far, usually none or very few
+    vector<pair<int, string>> decoded_;
+};
+
+template<typename T>
+struct IsPair : std::false_type
+{
+};
+
+template<typename First, typename Second>
+struct IsPair<pair<First, Second>> : std::true_type
+{
+};
+
+/**
+ * Numbers that the batched range path writes itself, bool and char are rendered as text instead
+ */
+template<typename T>
+constexpr bool kIsBatchNumber = (std::is_integral_v<T> and not std::is_same_v<T, bool> and
+                                 not std::is_same_v<T, char>) or
+                                std::is_same_v<T, float> or std::is_same_v<T, double>;
+
+/**
+ * Write one element of a range argument with the spec of its {***}, a pair is written as k: v
+ */
+template<typename T>
+void RenderElement(Writer& writer, const T& element, const Parser::FormatInfo& format_info)
+{
+    if constexpr (kIsBatchNumber<T> and std::is_integral_v<T>)
+    {
+        RenderInteger(writer, element, format_info.type);
+    }
+    else if constexpr (kIsBatchNumber<T>)
+    {
+        RenderFloatingPoint(writer, element, format_info);
+    }
+    else if constexpr (IsPair<T>::value)
+    {
+        RenderElement(writer, element.first, format_info);
+        writer.Append(": ", 2);
+        RenderElement(writer, element.second, format_info);
+    }
+    else
+    {
+        // anything else, nested ranges included, is captured like an argument of its own
+        auto args_data = CaptureArgs(element);
+        ArgRenderer(ArgList{args_data.data(), args_data.size()}).Render(writer, format_info);
+    }
+}
+
+/**
+ * Write size numbers separated by separator. The text is built in one stack buffer which is
+ * appended to writer when it is full, instead of appending every number and separator on its own
+ */
+template<typename T>
+void RenderNumbers(Writer& writer, const T* values, size_t size, std::string_view separator,
+                   const Parser::FormatInfo& format_info)
+{
+    char buffer[2048];
+    size_t used = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (i != 0)
+        {
+            if (sizeof(buffer) - used < separator.size() + kMaxIntegerSize)
+            {
+                writer.Append(buffer, used);
+                used = 0;
+            }
+            if (separator.size() + kMaxIntegerSize > sizeof(buffer))
+            {
+                writer.Append(separator);
+            }
+            else
+            {
+                std::memcpy(buffer + used, separator.data(), separator.size());
+                used += separator.size();
+            }
+        }
+        if (sizeof(buffer) - used < kMaxIntegerSize)
+        {
+            writer.Append(buffer, used);
+            used = 0;
+        }
+
+        if constexpr (std::is_integral_v<T>)
+        {
+            char number[kMaxIntegerSize];
+            char* end = number + sizeof(number);
+            char* begin = FormatInteger(end, values[i], format_info.type);
+            std::memcpy(buffer + used, begin, end - begin);
+            used += end - begin;
+        }
+        else
+        {
+#if defined(__cpp_lib_to_chars)
+            auto result = format_info.should_format
+                          ? std::to_chars(buffer + used, buffer + sizeof(buffer), values[i],
+                                          std::chars_format::fixed, format_info.fraction_num)
+                          : std::to_chars(buffer + used, buffer + sizeof(buffer), values[i]);
+            if (result.ec == std::errc())
+            {
+                used = result.ptr - buffer;
+                continue;
+            }
+#endif
+            // too long for the room left, e.g. 1e300 with .2f
+            writer.Append(buffer, used);
+            used = 0;
+            RenderFloatingPoint(writer, values[i], format_info);
+        }
+    }
+    writer.Append(buffer, used);
+}
+
+/**
+ * Write the elements of range separated by separator. The spec of the {***} applies to each element,
+ * its width applies to the whole range and is handled by ArgRenderer
+ */
+template<typename Range>
+void RenderRange(Writer& writer, const Range& range, std::string_view separator, const Parser::FormatInfo& format_info)
+{
+    Parser::FormatInfo element_info = format_info;
+    element_info.arg_index = 0;
+    element_info.width = 0;
+    element_info.align = 0;
+
+    using Element = std::remove_const_t<std::remove_reference_t<decltype(*std::begin(range))>>;
+    if constexpr (kIsBatchNumber<Element> and HasSize<Range>::value and HasData<Range>::value)
+    {
+        // contiguous numbers, e.g. std::vector<float> or std::array<int, N>
+        RenderNumbers(writer, std::data(range), std::size(range), separator, element_info);
+    }
+    else
+    {
+        bool first = true;
+        for (const auto& element : range)
+        {
+            if (not first)
+            {
+                writer.Append(separator);
+            }
+            first = false;
+            RenderElement(writer, element, element_info);
+        }
+    }
+}
+
+template<typename Range>
+void FormatRange(Writer& writer, const void* object, const Parser::FormatInfo& format_info)
+{
+    const auto& range = *static_cast<const Range*>(object);
+    using Element = std::remove_const_t<std::remove_reference_t<decltype(*std::begin(range))>>;
+    bool is_map = IsPair<Element>::value;
+    writer.Append(is_map ? '{' : '[');
+    RenderRange(writer, range, ", ", format_info);
+    writer.Append(is_map ? '}' : ']');
+}
+
+template<typename View>
+void FormatJoin(Writer& writer, const void* object, const Parser::FormatInfo& format_info)
+{
+    const auto& view = *static_cast<const View*>(object);
+    RenderRange(writer, *view.range, view.separator, format_info);
+}
+
+/**
+ * Walk a template whose {***} are described by format_infos:
+ * on_literal(string_view) is called for the text between them and on_field(FormatInfo) for each of them
+ */
+template<typename OnLiteral, typename OnField>
+void ForEachSegment(std::string_view s, const Parser::FormatInfo* format_infos, size_t format_info_num,
+                    OnLiteral&& on_literal, OnField&& on_field)
+{
+    int begin = 0;
+    for (size_t i = 0; i < format_info_num; i++)
+    {
+        auto& format_info = format_infos[i];
+        on_literal(s.substr(begin, format_info.begin - begin));
+        on_field(format_info);
+        begin = format_info.end + 1;
+    }
+    on_literal(s.substr(begin));
+}
+
+/**
+ * Walk a template known only at run time, each {***} is parsed when it is reached
+ */
+template<typename OnLiteral, typename OnField>
+void ForEachSegment(std::string_view s, OnLiteral&& on_literal, OnField&& on_field)
+{
+    int begin = 0;
+#if defined(MY_FORMAT_STATS)
+    // each field is parsed between two callbacks
+    uint64_t parse_start = FormatStats::Now();
+#endif
+    Parser::ForEachField(s, [&](const Parser::FormatInfo& format_info) {
+#if defined(MY_FORMAT_STATS)
+        FormatStats::Charge(&TemplateStats::parse_ns, FormatStats::Now() - parse_start);
+#endif
+        on_literal(s.substr(begin, format_info.begin - begin));
+        on_field(format_info);
+        begin = format_info.end + 1;
+#if defined(MY_FORMAT_STATS)
+        parse_start = FormatStats::Now();
+#endif
+    });
+#if defined(MY_FORMAT_STATS)
+    FormatStats::Charge(&TemplateStats::parse_ns, FormatStats::Now() - parse_start);
+#endif
+    on_literal(s.substr(begin));
+}
+
+/**
+ * Walk a template that was parsed before
+ */
+template<typename OnLiteral, typename OnField>
+void ForEachSegment(const CompiledFormat& format, OnLiteral&& on_literal, OnField&& on_field)
+{
+    ForEachSegment(format.Str(), format.FormatInfos().data(), format.FormatInfos().size(), on_literal, on_field);
+}
+
+/**
+ * Walk a FORMAT_STRING, its table was built at compile time
+ */
+template<typename S, typename OnLiteral, typename OnField,
+         typename = std::enable_if_t<std::is_base_of_v<CompileTimeFormatString, S>>>
+void ForEachSegment(S, OnLiteral&& on_literal, OnField&& on_field)
+{
+    using Table = StaticFormat<S>;
+    ForEachSegment(Table::str, Table::infos.data(), Table::size, on_literal, on_field);
+}
+
+/**
+ * Render the template given by fmt, which is anything ForEachSegment accepts
+ */
+template<typename... Template>
+void RenderSegments(Writer& writer, ArgRenderer& arg_renderer, const Template& ...fmt)
+{
+    ForEachSegment(fmt...,
+                   [&writer](std::string_view literal) { writer.Append(literal); },
+                   [&writer, &arg_renderer](const Parser::FormatInfo& format_info) {
+                       arg_renderer.Render(writer, format_info);
+                   });
+}
+
+/**
+ * Whether two {***} render an argument the same way
+ */
+inline bool SameSpec(const Parser::FormatInfo& a, const Parser::FormatInfo& b)
+{
+    return a.should_format == b.should_format and a.fraction_num == b.fraction_num and a.width == b.width and
+           a.align == b.align and a.fill == b.fill and a.type == b.type;
+}
+
+/**
+ * For callers that keep the template and render it later, e.g. a logger: render now each argument i with
+ * eager[i] set, with the spec of the {***} that references it, and store where its text is in ranges[i].
+ * An argument that no {***} references is left empty. Return false when an argument is referenced with
+ * two different specs, one text can not stand for both and the caller has to render the whole template
+ */
+template<typename FormatString, size_t N>
+bool RenderReferencedArgs(Writer& writer, ArgRenderer& arg_renderer, const FormatString& fmt,
+                          const std::array<bool, N>& eager, std::array<pair<size_t, size_t>, N>& ranges)
+{
+    std::array<bool, N> rendered{};
+    std::array<Parser::FormatInfo, N> specs;
+    bool same = true;
+    ForEachSegment(fmt,
+                   [](std::string_view) {},
+                   [&](const Parser::FormatInfo& format_info) {
+                       size_t i = static_cast<size_t>(format_info.arg_index);
+                       if (i >= N or not eager[i])
+                       {
+                           return;
+                       }
+                       if (rendered[i])
+                       {
+                           same = same and SameSpec(specs[i], format_info);
+                           return;
+                       }
+                       ranges[i].first = writer.Size();
+                       arg_renderer.Render(writer, format_info);
+                       ranges[i].second = writer.Size();
+                       rendered[i] = true;
+                       specs[i] = format_info;
+                   });
+    return same;
+}
+
+/*
+ * The non-template core, defined in my_format_cpp17.cpp and built as the my_format_core library.
+ * The templates below only capture their arguments into an ArgList and call one of these,
+ * so parsing and rendering are compiled once instead of once per argument pack
+ */
+
+/**
+ * Write s to writer, replacing each {***} described in format_infos by its argument
+ */
+void Render(Writer& writer, std::string_view s,
+            const Parser::FormatInfo* format_infos, size_t format_info_num,
+            ArgList args);
+
+/**
+ * Render a template known only at run time, each {***} is parsed when it is reached
+ */
+void Render(Writer& writer, std::string_view s, ArgList args);
+
+/**
+ * Render a template that was parsed before
+ */
+void Render(Writer& writer, const CompiledFormat& format, ArgList args);
+
+/**
+ * Render into a new string, allocated once at its exact size
+ */
+string VFormat(std::string_view s, const Parser::FormatInfo* format_infos, size_t format_info_num, ArgList args);
+string VFormat(std::string_view s, ArgList args);
+string VFormat(const CompiledFormat& format, ArgList args);
+
+/**
+ * Exact length of the output of Render, see ArgRenderer::Size
+ */
+size_t VFormattedSize(std::string_view s, const Parser::FormatInfo* format_infos, size_t format_info_num,
+                      ArgList args);
+size_t VFormattedSize(std::string_view s, ArgList args);
+size_t VFormattedSize(const CompiledFormat& format, ArgList args);
+
+/**
+ * Render a FORMAT_STRING, its table was built at compile time
+ */
+template<typename S, typename = std::enable_if_t<std::is_base_of_v<CompileTimeFormatString, S>>>
+void Render(Writer& writer, S, ArgList args)
+{
+    using Table = StaticFormat<S>;
+    Render(writer, Table::str, Table::infos.data(), Table::size, args);
+}
+
+template<typename S, typename = std::enable_if_t<std::is_base_of_v<CompileTimeFormatString, S>>>
+string VFormat(S, ArgList args)
+{
+    using Table = StaticFormat<S>;
+    return VFormat(Table::str, Table::infos.data(), Table::size, args);
+}
+
+template<typename S, typename = std::enable_if_t<std::is_base_of_v<CompileTimeFormatString, S>>>
+size_t VFormattedSize(S, ArgList args)
+{
+    using Table = StaticFormat<S>;
+    return VFormattedSize(Table::str, Table::infos.data(), Table::size, args);
+}
+
+/**
+ * Format function. Formatting shares no mutable state between threads: there is no stream or locale,
+ * numbers are converted with std::to_chars and the output goes to a buffer on the stack,
+ * so threads formatting at the same time do not slow each other down
+ */
+template<typename... Args>
+string Format(std::string_view s, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+    return VFormat(s, ArgList{args_data.data(), args_data.size()});
+}
+
+/**
+ * Format function for FORMAT_STRING, only the rendering is done at run time
+ */
+template<typename S, typename... Args, typename = std::enable_if_t<std::is_base_of_v<CompileTimeFormatString, S>>>
+string Format(S s, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+    return VFormat(s, ArgList{args_data.data(), args_data.size()});
+}
+
+/**
+ * Format function for a template that was parsed before
+ */
+template<typename... Args>
+string Format(const CompiledFormat& format, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+    return VFormat(format, ArgList{args_data.data(), args_data.size()});
+}
+
+/**
+ * Exact length of what Format(fmt, args...) returns, e.g. to reserve room before FormatTo.
+ * fmt may be a string, a CompiledFormat or a FORMAT_STRING
+ */
+template<typename FormatString, typename... Args>
+size_t FormattedSize(const FormatString& fmt, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+    return VFormattedSize(fmt, ArgList{args_data.data(), args_data.size()});
+}
+
+/**
+ * Format function which parses s only the first time the calling thread sees it, using FormatCache::Local().
+ * A cache per thread keeps threads from contending on one lock and one set of shared_ptr counts
+ */
+template<typename... Args>
+string FormatCached(std::string_view s, Args&& ...args)
+{
+    return Format(*FormatCache::Local().Get(s), std::forward<Args>(args)...);
+}
+
+/**
+ * Render s to sink in chunks of at most chunk_size bytes. The {***} are parsed as they are reached,
+ * so nothing grows with the size of s or of the output, and the first chunk leaves early.
+ * s may be a MappedFile of up to 2 GB (INT_MAX bytes), a larger s throws before anything is written
+ */
+template<typename... Args>
+void FormatStream(const ChunkWriter::Sink& sink, size_t chunk_size, std::string_view s, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+
+    ChunkWriter writer(sink, chunk_size);
+    Render(writer, s, ArgList{args_data.data(), args_data.size()});
+    writer.Flush();
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Write all of data to fd, retrying on partial writes and EINTR
+ */
+void WriteAll(int fd, const char* data, size_t size);
+
+/**
+ * FormatStream to a file descriptor
+ */
+template<typename... Args>
+void FormatStream(int fd, std::string_view s, Args&& ...args)
+{
+    FormatStream([fd](std::string_view chunk) { WriteAll(fd, chunk.data(), chunk.size()); },
+                 ChunkWriter::kDefaultChunkSize, s, std::forward<Args>(args)...);
+}
+
+/**
+ * A read-only memory mapping of a whole file, e.g. a large template for FormatStream.
+ * Pages are read on demand, throws when the file cannot be mapped
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const char* path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view Str() const
+    {
+        return std::string_view(data_, size_);
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+#endif
+
+/**
+ * Format into a Writer, e.g. from the FormatTo() member of a custom type.
+ * fmt may be a string, a CompiledFormat or a FORMAT_STRING
+ */
+template<typename FormatString, typename... Args>
+void FormatTo(Writer& writer, const FormatString& fmt, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+    Render(writer, fmt, ArgList{args_data.data(), args_data.size()});
+}
+
+/**
+ * Format into out, which is any output iterator of char, and return the iterator past the last char.
+ * fmt may be a string, a CompiledFormat or a FORMAT_STRING
+ */
+template<typename OutputIt, typename FormatString, typename... Args,
+         typename = std::enable_if_t<not std::is_base_of_v<Writer, OutputIt>>>
+OutputIt FormatTo(OutputIt out, const FormatString& fmt, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+
+    if constexpr (std::is_same_v<OutputIt, char*>)
+    {
+        // the caller guarantees the room, so write in place
+        PointerWriter writer(out);
+        Render(writer, fmt, ArgList{args_data.data(), args_data.size()});
+        return out + writer.Size();
+    }
+    else
+    {
+        IteratorWriter<OutputIt> writer(out);
+        Render(writer, fmt, ArgList{args_data.data(), args_data.size()});
+        return writer.Flush();
+    }
+}
+
+struct FormatToNResult
+{
+    // past the last char written into the buffer
+    char* out;
+    // length of the whole output, which is larger than out - buffer when it was truncated
+    size_t size;
+};
+
+/**
+ * Format into buffer without writing more than n chars, the output is not null terminated
+ */
+template<typename FormatString, typename... Args>
+FormatToNResult FormatToN(char* buffer, size_t n, const FormatString& fmt, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+
+    TruncatingWriter writer(buffer, n);
+    Render(writer, fmt, ArgList{args_data.data(), args_data.size()});
+    return {buffer + writer.Written(), writer.Total()};
+}
+
+/**
+ * Append the output to out, reusing its capacity. Call out.clear() first to overwrite it.
+ * fmt may be a string, a CompiledFormat or a FORMAT_STRING
+ */
+template<typename FormatString, typename... Args>
+void FormatInto(string& out, const FormatString& fmt, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+
+    StringWriter writer(out);
+    Render(writer, fmt, ArgList{args_data.data(), args_data.size()});
+    writer.Finish();
+}
+
+/**
+ * Format into a string taken from the thread-local BufferPool, it goes back to the pool when destroyed
+ */
+template<typename FormatString, typename... Args>
+PooledString FormatPooled(const FormatString& fmt, Args&& ...args)
+{
+    string out = BufferPool::Local().Acquire();
+    FormatInto(out, fmt, std::forward<Args>(args)...);
+    return PooledString(std::move(out));
+}
+
+/**
+ * Format and write to file with a single fwrite, without a temporary string and without flushing.
+ * fmt may be a string, a CompiledFormat or a FORMAT_STRING
+ */
+template<typename FormatString, typename... Args>
+void Print(FILE* file, const FormatString& fmt, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+
+    MemoryWriter writer;
+    Render(writer, fmt, ArgList{args_data.data(), args_data.size()});
+    if (std::fwrite(writer.Data(), 1, writer.Size(), file) != writer.Size())
+    {
+        throw "Failed to write to file";
+    }
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Write to fd with writev: literals are written straight from the template and
+ * arguments from a scratch buffer, there is no intermediate string
+ */
+void VPrint(int fd, std::string_view s, const Parser::FormatInfo* format_infos, size_t format_info_num,
+            ArgList args);
+void VPrint(int fd, std::string_view s, ArgList args);
+void VPrint(int fd, const CompiledFormat& format, ArgList args);
+
+template<typename S, typename = std::enable_if_t<std::is_base_of_v<CompileTimeFormatString, S>>>
+void VPrint(int fd, S, ArgList args)
+{
+    using Table = StaticFormat<S>;
+    VPrint(fd, Table::str, Table::infos.data(), Table::size, args);
+}
+
+/**
+ * Format and write to fd with a single writev when the template has up to 64 segments.
+ * Do not mix it with buffered stdio on the same file without fflush.
+ * fmt may be a string, a CompiledFormat or a FORMAT_STRING
+ */
+template<typename FormatString, typename... Args>
+void Print(int fd, const FormatString& fmt, Args&& ...args)
+{
+    auto args_data = CaptureArgs(std::forward<Args>(args)...);
+    VPrint(fd, fmt, ArgList{args_data.data(), args_data.size()});
+}
+#endif
+
+/**
+ * See Parser::FixedWidthSize, always string::npos for a template that is not parsed yet
+ */
+inline size_t FixedWidthSize(std::string_view s)
+{
+    return string::npos;
+}
+
+inline size_t FixedWidthSize(const CompiledFormat& format)
+{
+    return format.FixedWidthSize();
+}
+
+template<typename S, typename = std::enable_if_t<std::is_base_of_v<CompileTimeFormatString, S>>>
+constexpr size_t FixedWidthSize(S)
+{
+    return StaticFormat<S>::fixed_width_size;
+}
+
+/**
+ * Check whether a type can be unpacked by std::apply, e.g. std::tuple, std::pair or std::array
+ */
+template<typename T, typename = void>
+struct IsTupleLike : std::false_type
+{
+};
+
+template<typename T>
+struct IsTupleLike<T, std::void_t<decltype(std::tuple_size<T>::value)>> : std::true_type
+{
+};
+
+/**
+ * Render one row of FormatMany, a tuple-like row gives one argument per element,
+ * anything else is the only argument
+ */
+template<typename FormatString, typename Row>
+void RenderRow(Writer& writer, const FormatString& fmt, const Row& row)
+{
+    if constexpr (IsTupleLike<Row>::value)
+    {
+        std::apply([&writer, &fmt](const auto& ...fields) {
+            auto args_data = CaptureArgs(fields...);
+            Render(writer, fmt, ArgList{args_data.data(), args_data.size()});
+        }, row);
+    }
+    else
+    {
+        auto args_data = CaptureArgs(row);
+        Render(writer, fmt, ArgList{args_data.data(), args_data.size()});
+    }
+}
+
+/**
+ * Append one rendering of fmt per row to out, separated by separator. The template is parsed once,
+ * and when rows has a size() the output is sized from the first row so that it rarely grows again
+ */
+template<typename FormatString, typename Range>
+void FormatManyInto(string& out, const FormatString& fmt, const Range& rows, std::string_view separator = "\n")
+{
+    if constexpr (std::is_convertible_v<const FormatString&, std::string_view>)
+    {
+        FormatManyInto(out, CompiledFormat(string(std::string_view(fmt))), rows, separator);
+    }
+    else
+    {
+        StringWriter writer(out);
+        size_t fixed_width_size = FixedWidthSize(fmt);
+        if constexpr (HasSize<Range>::value)
+        {
+            if (fixed_width_size != string::npos)
+            {
+                // fixed-width rows, the whole output is known up front
+                writer.Reserve((fixed_width_size + separator.size()) * std::size(rows));
+            }
+        }
+        size_t row_index = 0;
+        for (const auto& row : rows)
+        {
+            if (row_index != 0)
+            {
+                writer.Append(separator);
             }
-            else if (arg.data_type == DataType::kFloat)
+            RenderRow(writer, fmt, row);
+            if constexpr (HasSize<Range>::value)
             {
-                if (format_info.should_format)
+                if (row_index == 0 and fixed_width_size == string::npos)
                 {
-                    sbuf.setf(std::ios::fixed);
-                    sbuf.precision(format_info.fraction_num);
+                    // estimate every row from the first one, plus a little for longer numbers
+                    size_t row_size = writer.Size() + separator.size();
+                    writer.Reserve(row_size + row_size * 9 / 8 * (std::size(rows) - 1));
                 }
-                sbuf << arg.data.float_data;
             }
-            else if (arg.data_type == DataType::kDouble)
+            row_index++;
+        }
+        writer.Finish();
+    }
+}
+
+/**
+ * One rendering of fmt per row, separated by separator, in one string
+ */
+template<typename FormatString, typename Range>
+string FormatMany(const FormatString& fmt, const Range& rows, std::string_view separator = "\n")
+{
+    string out;
+    FormatManyInto(out, fmt, rows, separator);
+    return out;
+}
+
+/**
+ * Run task(i) for every i in [0, task_num) on thread_num threads, the calling thread included.
+ * Threads take the next i from a shared counter, so a slow task does not hold back the others.
+ * The first exception thrown by a task is rethrown here once every thread is done
+ */
+template<typename Task>
+void ParallelFor(size_t thread_num, size_t task_num, const Task& task)
+{
+    std::atomic<size_t> next_task{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        for (size_t i = next_task++; i < task_num; i = next_task++)
+        {
+            try
+            {
+                task(i);
+            }
+            catch (...)
             {
-                if (format_info.should_format)
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (not error)
                 {
-                    sbuf.setf(std::ios::fixed);
-                    sbuf.precision(format_info.fraction_num);
+                    error = std::current_exception();
                 }
-                sbuf << arg.data.double_data;
+                // stop handing out work
+                next_task = task_num;
             }
-            else if (arg.data_type == DataType::kString)
+        }
+    };
+
+    vector<std::thread> threads;
+    threads.reserve(thread_num > 0 ? thread_num - 1 : 0);
+    for (size_t i = 1; i < thread_num; i++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * FormatManyInto on several threads, thread_num 0 means one per core. The output is the same as FormatManyInto:
+ * rows are cut into chunks rendered into their own buffers, then the buffers are copied to out
+ * at offsets summed in row order. Custom types in rows must be safe to render from several threads.
+ * rows must be random access with a size(), otherwise, and for small jobs, this is FormatManyInto
+ */
+template<typename FormatString, typename Range>
+void FormatManyParallelInto(string& out, const FormatString& fmt, const Range& rows,
+                            std::string_view separator = "\n", size_t thread_num = 0)
+{
+    using Iterator = decltype(std::begin(rows));
+    constexpr bool kRandomAccess = std::is_base_of_v<std::random_access_iterator_tag,
+                                                     typename std::iterator_traits<Iterator>::iterator_category>;
+    // below this a job is over before the threads start
+    constexpr size_t kMinRowsPerThread = 4096;
+    // more chunks than threads so that the threads finish together
+    constexpr size_t kChunksPerThread = 8;
+
+    if constexpr (std::is_convertible_v<const FormatString&, std::string_view>)
+    {
+        FormatManyParallelInto(out, CompiledFormat(string(std::string_view(fmt))), rows, separator, thread_num);
+    }
+    else if constexpr (not kRandomAccess or not HasSize<Range>::value)
+    {
+        FormatManyInto(out, fmt, rows, separator);
+    }
+    else
+    {
+        size_t row_num = std::size(rows);
+        if (thread_num == 0)
+        {
+            thread_num = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        }
+        thread_num = std::min(thread_num, row_num / kMinRowsPerThread);
+        if (thread_num <= 1)
+        {
+            FormatManyInto(out, fmt, rows, separator);
+            return;
+        }
+
+        size_t chunk_rows = (row_num + thread_num * kChunksPerThread - 1) / (thread_num * kChunksPerThread);
+        size_t chunk_num = (row_num + chunk_rows - 1) / chunk_rows;
+        size_t fixed_width_size = FixedWidthSize(fmt);
+        Iterator first = std::begin(rows);
+        vector<string> chunks(chunk_num);
+        ParallelFor(thread_num, chunk_num, [&](size_t chunk_index) {
+            size_t begin = chunk_index * chunk_rows;
+            size_t end = std::min(begin + chunk_rows, row_num);
+            StringWriter writer(chunks[chunk_index]);
+            if (fixed_width_size != string::npos)
             {
-                sbuf << arg.str_data;
+                writer.Reserve((fixed_width_size + separator.size()) * (end - begin));
             }
-            else if (arg.data_type == DataType::kCustom)
+            for (size_t row_index = begin; row_index < end; row_index++)
             {
-                sbuf << arg.str_data;
+                if (row_index != 0)
+                {
+                    writer.Append(separator);
+                }
+                RenderRow(writer, fmt, first[row_index]);
+                if (row_index == begin and fixed_width_size == string::npos)
+                {
+                    size_t row_size = writer.Size() + separator.size();
+                    writer.Reserve(row_size + row_size * 9 / 8 * (end - begin - 1));
+                }
             }
+            writer.Finish();
+        });
+
+        // stitch, each chunk knows where it goes so the copies run in parallel too
+        vector<size_t> offsets(chunk_num);
+        size_t offset = out.size();
+        for (size_t i = 0; i < chunk_num; i++)
+        {
+            offsets[i] = offset;
+            offset += chunks[i].size();
         }
-        begin = format_info.end + 1;
+        out.resize(offset);
+        ParallelFor(thread_num, chunk_num, [&](size_t chunk_index) {
+            std::memcpy(out.data() + offsets[chunk_index], chunks[chunk_index].data(), chunks[chunk_index].size());
+            string().swap(chunks[chunk_index]);
+        });
     }
-    sbuf << s.substr(begin , s.size() - begin);
-    return sbuf.str();
-}
\ No newline at end of file
+}
+
+/**
+ * FormatMany on several threads, see FormatManyParallelInto
+ */
+template<typename FormatString, typename Range>
+string FormatManyParallel(const FormatString& fmt, const Range& rows, std::string_view separator = "\n",
+                          size_t thread_num = 0)
+{
+    string out;
+    FormatManyParallelInto(out, fmt, rows, separator, thread_num);
+    return out;
+}